@@ -1,55 +1,67 @@
 /* DHT22 / AM2302 driver */
 #include <stdbool.h>
+#include <string.h>
 #include "stm32f10x.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
 #include "am2302.h"
+#include "dht_decode.h"
 
 #define DHT_BIT_TIMEOUT_US (80 * 4) /* one bit timeout */
 #define DHT_START_PULSE_MS 2
-#define DHT_IRQ_TIMEOUT_MS 2 /* irq timeout */
-#define DHT_PKT_SIZE 5
-#define DHT_PKT_TIMEOUT_MS 10
+#define DHT_FRAME_TIMEOUT_MS 8 /* whole frame capture timeout, ~5.5ms max */
+#define DHT_PKT_TIMEOUT_MS 20
+#define DHT_EDGES (2 + DHT_PKT_SIZE * 8) /* first falling edge, response and data bits */
 
 /*-----------------------------------------------------------------------------*/
-/* Use TIM3_CH1 */
-#define DHT_GPIO GPIOC
-#define DHT_PIN GPIO_Pin_6
+/*
+Use TIM3_CH1, the only timer not taken by the dimmer.
+Sensors sit on alternative TIM3_CH1 pins and are read back-to-back,
+the pin is selected by TIM3 remap before each read (see dht_sensors).
+*/
 #define DHT_CLK_ENABLE \
 do { \
 	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM3, ENABLE); \
-	RCC_APB2PeriphClockCmd((RCC_APB2Periph_GPIOC | RCC_APB2Periph_AFIO), ENABLE); \
+	RCC_APB2PeriphClockCmd((RCC_APB2Periph_GPIOA | RCC_APB2Periph_GPIOC | RCC_APB2Periph_AFIO), ENABLE); \
 } while(0)
 #define DHT_TIMER TIM3 /* Uses APB2 clock */
 #define DHT_TIMER_CHANNEL TIM_Channel_1
+#define DHT_TIMER_REMAP_MASK GPIO_FullRemap_TIM3 /* clears both remap bits */
 #define DHT_IRQN TIM3_IRQn
-#define DHT_GPIO_REMAP GPIO_FullRemap_TIM3
 #define DHT_IRQ_HANDLER TIM3_IRQHandler
 
+/* TIM3_CH1 DMA request, shared with USART2_RX */
+#define DHT_DMA DMA1_Channel6
+#define DHT_DMA_IRQN DMA1_Channel6_IRQn
+#define DHT_DMA_FLAGS DMA1_FLAG_GL6
+#define DHT_DMA_IRQ_HANDLER DMAChannel6_IRQHandler
+
 #define DHT_GET_PCLK_FREQ(x) (((RCC->CFGR >> 8) & 0x7) >= 4 ? (x)->PCLK1_Frequency * 2 : (x)->PCLK1_Frequency)
 
 #define DHT_IRQ_PRIO configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
 #define DHT_PRIO (configMAX_PRIORITIES - 1)
-
-#define ERROR_DIV 2
-#define PERIOD_OK(x, l, h) \
-	((x)->low >= ((l) - (l) / ERROR_DIV) && \
-	(x)->low < ((l) + (l) / ERROR_DIV) && \
-	((x)->period - (x)->low) >= ((h) - (h) / ERROR_DIV) && \
-	((x)->period - (x)->low) < ((h) + (h) / ERROR_DIV))
 /*-----------------------------------------------------------------------------*/
 
 typedef struct _pwm_capture_t pwm_capture_t;
 typedef struct _dht_read_t dht_read_t;
+typedef struct _dht_sensor_t dht_sensor_t;
 
+/* layout matches CCR1, CCR2 DMA burst */
 struct _pwm_capture_t {
-	unsigned int period;
-	unsigned int low;
+	uint16_t period;
+	uint16_t low;
+};
+
+struct _dht_sensor_t {
+	GPIO_TypeDef *gpio;
+	uint16_t pin;
+	uint32_t remap; /* TIM3 remap selecting the pin, 0 for none */
 };
 
 struct _dht_read_t {
+	int sensor; /* in */
 	xSemaphoreHandle sem; /* in */
 	dht_error_t error; /* out */
 	uint8_t data[DHT_PKT_SIZE]; /* out */
@@ -59,29 +71,41 @@ static void dht_thread(void *data);
 static inline void start_timer();
 static inline void stop_timer();
 /*-----------------------------------------------------------------------------*/
+static const dht_sensor_t dht_sensors[DHT_SENSOR_NUM] = {
+	{.gpio = GPIOC, .pin = GPIO_Pin_6, .remap = GPIO_FullRemap_TIM3,}, /* canopy */
+	{.gpio = GPIOA, .pin = GPIO_Pin_6, .remap = 0,}, /* root zone */
+};
+
 static xQueueHandle cmd_msgbox; /* read requests */
 static xSemaphoreHandle irq_sem;
-static volatile pwm_capture_t pwm_data;
+static volatile pwm_capture_t pwm_data[DHT_EDGES];
+static dht_decoder_t decoder; /* written by ISR, read by task after irq_sem */
 /*-----------------------------------------------------------------------------*/
 
-static void gpio_input() {
+static void gpio_input(const dht_sensor_t *sensor) {
 	/* Pin configuration: input floating */
 	GPIO_InitTypeDef gpconf = {
-		.GPIO_Pin = DHT_PIN,
+		.GPIO_Pin = sensor->pin,
 		.GPIO_Mode = GPIO_Mode_IN_FLOATING,
 		.GPIO_Speed = GPIO_Speed_50MHz,
 	};
-	GPIO_Init(DHT_GPIO, &gpconf);
+	GPIO_Init(sensor->gpio, &gpconf);
 }
 
-static void gpio_output() {
+static void gpio_output(const dht_sensor_t *sensor) {
 	/* Pin configuration: output open-drain */
 	GPIO_InitTypeDef gpconf = {
-		.GPIO_Pin = DHT_PIN,
+		.GPIO_Pin = sensor->pin,
 		.GPIO_Mode = GPIO_Mode_Out_OD,
 		.GPIO_Speed = GPIO_Speed_50MHz,
 	};
-	GPIO_Init(DHT_GPIO, &gpconf);
+	GPIO_Init(sensor->gpio, &gpconf);
+}
+
+/* route the sensor pin to the capture channel */
+static void select_sensor(const dht_sensor_t *sensor) {
+	GPIO_PinRemapConfig(DHT_TIMER_REMAP_MASK, DISABLE);
+	if(sensor->remap) GPIO_PinRemapConfig(sensor->remap, ENABLE);
 }
 
 int dht_init() {
@@ -96,11 +120,9 @@ int dht_init() {
 	DHT_CLK_ENABLE;
 
 	/* Pin configuration */
-	gpio_input();
-
-#ifdef DHT_GPIO_REMAP
-	GPIO_PinRemapConfig(DHT_GPIO_REMAP, ENABLE);
-#endif
+	int i;
+	for(i = 0; i < DHT_SENSOR_NUM; i++) gpio_input(&dht_sensors[i]);
+	select_sensor(&dht_sensors[0]);
 
 	/* Enable the TIM global Interrupt */
 	NVIC_InitTypeDef itconf = {
@@ -111,6 +133,28 @@ int dht_init() {
 	};
 	NVIC_Init(&itconf);
 
+	itconf.NVIC_IRQChannel = DHT_DMA_IRQN;
+	NVIC_Init(&itconf);
+
+	/* Capture pairs are moved to the edge buffer, DMA counter is reloaded per read */
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+	DMA_InitTypeDef dmaconf = {
+		.DMA_PeripheralBaseAddr = (uint32_t)&DHT_TIMER->DMAR,
+		.DMA_MemoryBaseAddr = (uint32_t)pwm_data,
+		.DMA_DIR = DMA_DIR_PeripheralSRC,
+		.DMA_BufferSize = DHT_EDGES * 2,
+		.DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+		.DMA_MemoryInc = DMA_MemoryInc_Enable,
+		.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord,
+		.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord,
+		.DMA_Mode = DMA_Mode_Normal,
+		.DMA_Priority = DMA_Priority_High,
+		.DMA_M2M = DMA_M2M_Disable,
+	};
+	DMA_DeInit(DHT_DMA);
+	DMA_Init(DHT_DMA, &dmaconf);
+	DMA_ITConfig(DHT_DMA, DMA_IT_TC, ENABLE);
+
 	/* Give 1us resolution */
 	RCC_ClocksTypeDef clocks;
 	RCC_GetClocksFreq(&clocks);
@@ -134,6 +178,9 @@ int dht_init() {
 	/* Configures the TIM Update Request Interrupt source: counter overflow */
 	TIM_UpdateRequestConfig(DHT_TIMER, TIM_UpdateSource_Regular);
 
+	/* Each CC1 request transfers CCR1 (period) and CCR2 (low) through DMAR */
+	TIM_DMAConfig(DHT_TIMER, TIM_DMABase_CCR1, TIM_DMABurstLength_2Transfers);
+
 	DHT_TIMER->CNT = 0;
 	DHT_TIMER->ARR = DHT_BIT_TIMEOUT_US; /* Set the TIM auto-reload register */
 	DHT_TIMER->SR = ~(TIM_FLAG_Update | TIM_FLAG_CC1);
@@ -141,40 +188,57 @@ int dht_init() {
 	return 0;
 }
 
-void DHT_IRQ_HANDLER(void) {
-	portBASE_TYPE preempt = pdFALSE;
-
-	if(DHT_TIMER->SR & TIM_FLAG_CC1) {
-		pwm_data.low = DHT_TIMER->CCR2;
-		pwm_data.period = DHT_TIMER->CCR1;
+/* decode captured edges and wake the task, runs in ISR context with the timer stopped */
+static void frame_done(portBASE_TYPE *preempt) {
+	unsigned int count = DHT_EDGES - DHT_DMA->CNDTR / 2;
+	unsigned int i;
 
-		DHT_TIMER->SR = ~TIM_FLAG_CC1;
+	dht_decoder_reset(&decoder);
+	for(i = 0; i < count && decoder.state == DHT_DEC_BUSY; i++)
+		dht_decoder_feed(&decoder, pwm_data[i].period, pwm_data[i].low);
 
-		xSemaphoreGiveFromISR(irq_sem, &preempt);
+	xSemaphoreGiveFromISR(irq_sem, preempt);
+}
 
-	} else if(DHT_TIMER->SR & TIM_FLAG_Update) {
-		/* timeout */
+void DHT_IRQ_HANDLER(void) {
+	portBASE_TYPE preempt = pdFALSE;
 
+	if(DHT_TIMER->SR & TIM_FLAG_Update) {
+		/* no edge for a bit time, end of frame or timeout */
 		DHT_TIMER->SR = ~TIM_FLAG_Update;
 		stop_timer();
-
-		pwm_data.period = 0;
-		xSemaphoreGiveFromISR(irq_sem, &preempt);
+		frame_done(&preempt);
 	}
 
 	portEND_SWITCHING_ISR(preempt);
 }
 
+void DHT_DMA_IRQ_HANDLER(void) {
+	portBASE_TYPE preempt = pdFALSE;
+
+	/* all edges captured */
+	DMA1->IFCR = DHT_DMA_FLAGS;
+	stop_timer();
+	frame_done(&preempt);
+
+	portEND_SWITCHING_ISR(preempt);
+}
+
 static inline void start_timer() {
-	DHT_TIMER->DIER |= (TIM_IT_Update | TIM_IT_CC1);
+	DHT_DMA->CCR &= ~DMA_CCR1_EN;
+	DHT_DMA->CNDTR = DHT_EDGES * 2;
+	DHT_DMA->CCR |= DMA_CCR1_EN;
+
+	DHT_TIMER->DIER |= (TIM_IT_Update | TIM_DMA_CC1);
 	DHT_TIMER->CNT = 0;
 	DHT_TIMER->SR = ~(TIM_FLAG_Update | TIM_FLAG_CC1);
     DHT_TIMER->CR1 |= TIM_CR1_CEN;
 }
 
 static inline void stop_timer() {
-	DHT_TIMER->DIER &= ~(TIM_IT_Update | TIM_IT_CC1);
+	DHT_TIMER->DIER &= ~(TIM_IT_Update | TIM_DMA_CC1);
     DHT_TIMER->CR1 &= ~TIM_CR1_CEN;
+	DHT_DMA->CCR &= ~DMA_CCR1_EN;
 }
 
 static void dht_thread(void *data) {
@@ -183,71 +247,44 @@ static void dht_thread(void *data) {
 		dht_read_t *req;
 		if(!xQueueReceive(cmd_msgbox, &req, portMAX_DELAY)) continue;
 
+		const dht_sensor_t *sensor = &dht_sensors[req->sensor];
+		select_sensor(sensor);
+
 		/* send start pulse */
-		gpio_output();
-		DHT_GPIO->BRR = DHT_PIN; /* 0 */
+		gpio_output(sensor);
+		sensor->gpio->BRR = sensor->pin; /* 0 */
 		vTaskDelay(DHT_START_PULSE_MS / portTICK_RATE_MS);
-		DHT_GPIO->BSRR = DHT_PIN; /* Hi-Z */
-		gpio_input();
+		sensor->gpio->BSRR = sensor->pin; /* Hi-Z */
+		gpio_input(sensor);
 
+		xSemaphoreTake(irq_sem, 0); /* to be sure */
 		start_timer();
 
-		/* skip first falling edge */
-		int i;
-		for(i = 0; i < 2; i++) {
-			/* IRQ timeout or receive timeout */
-			if(!xSemaphoreTake(irq_sem, DHT_IRQ_TIMEOUT_MS / portTICK_RATE_MS)) {
-				req->error = DHT_IRQ_TIMEOUT;
-				goto reply;
-			}
-			if(!pwm_data.period) {
-				req->error = DHT_TIMEOUT;
-				goto reply;
-			}
-		}
-		/* start sequence received */
-		if(!PERIOD_OK(&pwm_data, 80, 80)) {
+		/* whole frame is captured by DMA and decoded in ISR, single wakeup on completion or timeout */
+		if(!xSemaphoreTake(irq_sem, DHT_FRAME_TIMEOUT_MS / portTICK_RATE_MS)) {
+			stop_timer();
+			req->error = DHT_IRQ_TIMEOUT;
+		} else if(decoder.state == DHT_DEC_BUSY) {
+			req->error = DHT_TIMEOUT; /* frame cut short */
+		} else if(decoder.state == DHT_DEC_ERROR) {
 			req->error = DHT_DECODE_ERROR;
-			goto reply;
+		} else {
+			memcpy(req->data, decoder.data, DHT_PKT_SIZE);
+			req->error = DHT_NO_ERROR;
 		}
 
-		for(i = 0; i < DHT_PKT_SIZE; i++) {
-			unsigned int mask = 0x80;
-			uint8_t byte = 0;
-			while(mask) {
-				if(!xSemaphoreTake(irq_sem, DHT_IRQ_TIMEOUT_MS / portTICK_RATE_MS)) {
-					req->error = DHT_IRQ_TIMEOUT;
-					goto reply;
-				}
-				if(!pwm_data.period) {
-					req->error = DHT_TIMEOUT;
-					goto reply;
-				}
-
-				/* next bit received */
-				if(PERIOD_OK(&pwm_data, 50, 70)) {
-					byte |= mask; /* 1 */
-				} else if(!PERIOD_OK(&pwm_data, 50, 27)) {
-					req->error = DHT_DECODE_ERROR;
-					goto reply;
-				}
-
-				mask >>= 1;
-			}
-			req->data[i] = byte;
-		}
-		req->error = DHT_NO_ERROR;
-reply:
-		stop_timer();
 		xSemaphoreGive(req->sem);
 	}
 }
 
-int dht_read(xSemaphoreHandle read_sem, int *temperature, int *humidity, dht_error_t *error) {
+int dht_read(int sensor, xSemaphoreHandle read_sem, int *temperature, int *humidity, dht_error_t *error) {
 	dht_read_t rd;
 	dht_read_t *rd_p = &rd;
 
+	if(sensor < 0 || sensor >= DHT_SENSOR_NUM) return -1;
+
 	xSemaphoreTake(read_sem, 0); /* to be sure */
+	rd_p->sensor = sensor;
 	rd_p->sem = read_sem;
 	xQueueSend(cmd_msgbox, &rd_p, portMAX_DELAY);
 
@@ -6,6 +6,8 @@
 #include "semphr.h"
 
 #define DHT_COLLECTION_PERIOD_MS 2000UL
+#define DHT_MIN_INTERVAL_MS 2000UL /* between start signals to the same sensor */
+#define DHT_SENSOR_NUM 2
 
 typedef enum {
 	DHT_NO_ERROR,
@@ -14,11 +16,13 @@ typedef enum {
 	DHT_RCV_TIMEOUT,
 	DHT_DECODE_ERROR,
 	DHT_CHECKSUM_ERROR,
+	DHT_ERROR_NUM,
 } dht_error_t;
 
 /*-----------------------------------------------------------------------------*/
 int dht_init();
 /* temperature in 1/10 deg C, humidity in 1/10 % */
-int dht_read(xSemaphoreHandle read_sem, int *temperature, int *humidity, dht_error_t *error);
+/* sensors are read one at a time, concurrent requests are queued */
+int dht_read(int sensor, xSemaphoreHandle read_sem, int *temperature, int *humidity, dht_error_t *error);
 
 #endif
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -6,32 +7,16 @@
 #include "stm32f10x.h"
 #include "conf.h"
 #include "dimmer.h"
+#include "crc.h"
+#include "flash.h"
 
-extern char _eimage; /* from linker */
+#define CONF_VERSION 2 /* bump on any sys_conf_data_t layout change */
+#define CONF_MAGIC (0xAA55AA00 | CONF_VERSION)
 
-#if defined(STM32F10X_HD) || defined(STM32F10X_HD_VL) || defined(STM32F10X_CL) || defined(STM32F10X_XL)
-	#define FLASH_PAGE_SIZE 0x800
-#else
-	#define FLASH_PAGE_SIZE 0x400
-#endif
-
-#if defined(STM32F10X_LD) || defined(STM32F10X_LD_VL)
-	#define FLASH_SIZE 0x008000
-#elif defined(STM32F10X_MD) || defined(STM32F10X_MD_VL)
-	#define FLASH_SIZE 0x020000
-#elif defined(STM32F10X_CL)
-	#define FLASH_SIZE 0x040000
-#elif defined(STM32F10X_HD) || defined(STM32F10X_HD_VL)
-	#define FLASH_SIZE 0x080000
-#elif defined(STM32F10X_XL)
-	#define FLASH_SIZE 0x100000
-#endif
-
-#define CONF_AREA_START_ADDR (((unsigned long)&_eimage + FLASH_PAGE_SIZE - 1) & ~((unsigned long)FLASH_PAGE_SIZE - 1))
-#define CONF_AREA_SIZE (FLASH_SIZE + FLASH_BASE - CONF_AREA_START_ADDR)
-#define FLASH_END (FLASH_BASE + FLASH_SIZE)
-
-#define CONF_MAGIC 0xAA55AA55
+/* original image: same header, data up to fan_coef */
+#define CONF_V1_MAGIC 0xAA55AA55
+#define CONF_V1_DATA_SIZE offsetof(sys_conf_data_t, dimmer_power)
+#define CONF_V1_IMG_SIZE (4 + CONF_V1_DATA_SIZE + 4)
 
 typedef struct _conf_img_t {
 	uint32_t magic;
@@ -48,30 +33,36 @@ volatile sys_conf_data_t conf_data = {
 	},
 	.fan_lower_limit = DIMMER_MIN * FP_ONE,
 	.fan_upper_limit = DIMMER_MAX * FP_ONE,
+	.dimmer_ramp = FP_ONE / 2,
+	.filter_median = 3,
+	.filter_alpha = FP_ONE / 2,
+	.telem_enabled = 0,
+	.telem_baudrate = 460800,
+	.telem_period = 1000,
+	.telem_interval = 250,
+	.serial_policy = {
+		[0] = SERIAL_BLOCK, /* console */
+		[1] = SERIAL_DROP_NEWEST, /* telemetry stream */
+	},
+	.serial_autobaud = 0,
+	.log_period = 300,
 };
 
 static unsigned long conf_address = 0;
 
-static uint32_t calc_crc32(uint32_t *data, unsigned int size) {
-	CRC->CR = CRC_CR_RESET;
-	while(size--) CRC->DR = *(data++);
-	return CRC->DR;
-}
-
-void conf_init() {
-	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_CRC, ENABLE);
-
+/* last written image slot of the given size, images fill pages in order, NULL if area is empty */
+static const uint32_t *conf_find_last(unsigned int img_size) {
 	unsigned long addr = CONF_AREA_START_ADDR;
-	conf_img_t *found = NULL;
+	const uint32_t *found = NULL;
 
-	/* find last valid block */
-	while(addr < FLASH_END) {
-		conf_img_t *img = (conf_img_t*)addr;
+	while(addr < CONF_AREA_END_ADDR) {
+		const uint32_t *img = (const uint32_t*)addr;
 
 		/* find first free block */
-		int cnt = FLASH_PAGE_SIZE / sizeof(conf_img_t);
-		while(cnt && img->magic != 0xffffffff) {
-			found = img++;
+		int cnt = FLASH_PAGE_SIZE / img_size;
+		while(cnt && *img != 0xffffffff) {
+			found = img;
+			img += img_size / 4;
 			cnt--;
 		};
 		if(cnt) break;
@@ -79,14 +70,41 @@ void conf_init() {
 		addr += FLASH_PAGE_SIZE;
 	}
 
+	return found;
+}
+
+/* settings saved by firmware with the original layout, the rest keeps defaults */
+static bool conf_migrate_v1() {
+	const uint32_t *img = conf_find_last(CONF_V1_IMG_SIZE);
+	if(!img || img[0] != CONF_V1_MAGIC) return false;
+
+	uint32_t crc = crc32_calc((uint32_t*)&img[1], CONF_V1_DATA_SIZE / 4);
+	if(crc != img[1 + CONF_V1_DATA_SIZE / 4]) return false;
+
+	memcpy((void*)&conf_data, &img[1], CONF_V1_DATA_SIZE);
+	return true;
+}
+
+conf_status_t conf_init() {
+	crc_init();
+
+	const conf_img_t *found = (const conf_img_t*)conf_find_last(sizeof(conf_img_t));
 	if(found && found->magic == CONF_MAGIC) {
 		/* verify checksum */
-		uint32_t crc = calc_crc32((uint32_t*)&found->data, sizeof(sys_conf_data_t) / 4);
+		uint32_t crc = crc32_calc((uint32_t*)&found->data, sizeof(sys_conf_data_t) / 4);
 		if(crc == found->crc) {
 			conf_data = found->data;
 			conf_address = (unsigned long)found;
+			return CONF_LOADED;
 		}
 	}
+
+	/*
+	No image of this version. Images of other layouts are never parsed as this one,
+	the next write starts over from the first page.
+	*/
+	conf_address = 0;
+	return conf_migrate_v1() ? CONF_MIGRATED : CONF_DEFAULTS;
 }
 
 int conf_write() {
@@ -95,7 +113,7 @@ int conf_write() {
 	img.data = conf_data;
 
 	/* compute checksum */
-	img.crc = calc_crc32((uint32_t*)&img.data, sizeof(sys_conf_data_t) / 4);
+	img.crc = crc32_calc((uint32_t*)&img.data, sizeof(sys_conf_data_t) / 4);
 
 	unsigned long page_addr = CONF_AREA_START_ADDR;
 	unsigned long erase_page_addr = 0; /* don't erase */
@@ -109,11 +127,11 @@ int conf_write() {
 		if(idx == FLASH_PAGE_SIZE / sizeof(conf_img_t)) {
 			idx = 0;
 			page_addr += FLASH_PAGE_SIZE;
-			if(page_addr == FLASH_END) page_addr = CONF_AREA_START_ADDR;
+			if(page_addr == CONF_AREA_END_ADDR) page_addr = CONF_AREA_START_ADDR;
 		} else if(idx == FLASH_PAGE_SIZE / sizeof(conf_img_t) - 1) {
 			/* erase next page */
 			erase_page_addr = page_addr + FLASH_PAGE_SIZE;
-			if(erase_page_addr == FLASH_END) erase_page_addr = CONF_AREA_START_ADDR;
+			if(erase_page_addr == CONF_AREA_END_ADDR) erase_page_addr = CONF_AREA_START_ADDR;
 		}
 	} else {
 		erase_page_addr = CONF_AREA_START_ADDR;
@@ -122,7 +140,7 @@ int conf_write() {
 	conf_address = page_addr + idx * sizeof(conf_img_t);
 
 	/* perform write */
-	FLASH_Unlock();
+	flash_begin();
 
 	FLASH_Status status = FLASH_COMPLETE;
 	if(erase_page_addr) status = FLASH_ErasePage(erase_page_addr);
@@ -137,7 +155,7 @@ int conf_write() {
 		cnt--;
 	}
 
-	FLASH_Lock();
+	flash_end();
 
 	/* verify */
 	if(memcmp((void*)conf_address, &img, sizeof(conf_img_t))) status = FLASH_ERROR_PG;
@@ -3,6 +3,8 @@
 
 #include <time.h>
 #include "pid.h"
+#include "serial.h"
+#include "dimmer.h"
 
 typedef enum {
 	LIGHT_OFF = 0,
@@ -17,6 +19,7 @@ typedef enum {
 
 typedef struct _sys_conf_data_t sys_conf_data_t;
 
+/* fields up to fan_coef are the original layout migrated from older images, new ones go after it */
 struct _sys_conf_data_t {
 	light_mode_t light_mode;
 	struct tm daytime_start;
@@ -31,11 +34,39 @@ struct _sys_conf_data_t {
 	fixed_t fan_upper_limit;
 
 	pid_coef_t fan_coef;
+
+	/* Dimmer outputs without controller, percent */
+	fixed_t dimmer_power[DIMMER_CHANNELS];
+	dimmer_mode_t dimmer_mode[DIMMER_CHANNELS]; /* every output, phase angle or burst */
+	fixed_t dimmer_ramp; /* percent per mains period, 0 - immediate */
+
+	/* PID input filter */
+	unsigned int filter_median; /* median window, samples */
+	fixed_t filter_alpha; /* smoothing factor, 1 - no smoothing */
+
+	/* Telemetry stream on the second port */
+	int telem_enabled;
+	unsigned int telem_baudrate;
+	unsigned int telem_period; /* transmission period, ms */
+	unsigned int telem_interval; /* sampling interval, ms */
+
+	/* Serial ports transmit buffer overflow handling */
+	serial_policy_t serial_policy[SERIAL_NUM];
+	int serial_autobaud; /* detect console baud rate on boot */
+
+	/* Flash record log */
+	unsigned int log_period; /* s, 0 - disabled */
 } __attribute__((aligned(4)));
 
 extern volatile sys_conf_data_t conf_data;
 
-void conf_init();
+typedef enum {
+	CONF_LOADED,
+	CONF_MIGRATED, /* older image, fields it didn't have are defaults */
+	CONF_DEFAULTS, /* nothing usable saved */
+} conf_status_t;
+
+conf_status_t conf_init();
 int conf_write();
 
 #endif /* _CONF_H_ */
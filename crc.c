@@ -0,0 +1,23 @@
+#include <stdint.h>
+
+#include "stm32f10x.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "crc.h"
+
+void crc_init() {
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_CRC, ENABLE);
+}
+
+uint32_t crc32_calc(const uint32_t *data, unsigned int size) {
+	/* CRC unit is shared between tasks */
+	taskENTER_CRITICAL();
+	CRC->CR = CRC_CR_RESET;
+	while(size--) CRC->DR = *(data++);
+	uint32_t crc = CRC->DR;
+	taskEXIT_CRITICAL();
+
+	return crc;
+}
@@ -0,0 +1,10 @@
+#ifndef _CRC_H_
+#define _CRC_H_
+
+#include <stdint.h>
+
+void crc_init();
+/* hardware CRC32 over size 32 bit words */
+uint32_t crc32_calc(const uint32_t *data, unsigned int size);
+
+#endif
@@ -0,0 +1,46 @@
+/* DHT22 / AM2302 bit decoder */
+#include <string.h>
+#include "dht_decode.h"
+
+#define DHT_EDGE_START 0 /* host start pulse release, not measured */
+#define DHT_EDGE_RESPONSE 1 /* 80us low, 80us high */
+#define DHT_EDGE_DATA 2
+
+#define PERIOD_OK(p, lo, l, h) \
+	((lo) >= ((l) - (l) / DHT_TOLERANCE_DIV) && \
+	(lo) < ((l) + (l) / DHT_TOLERANCE_DIV) && \
+	((p) - (lo)) >= ((h) - (h) / DHT_TOLERANCE_DIV) && \
+	((p) - (lo)) < ((h) + (h) / DHT_TOLERANCE_DIV))
+/*-----------------------------------------------------------------------------*/
+
+void dht_decoder_reset(dht_decoder_t *dec) {
+	dec->state = DHT_DEC_BUSY;
+	dec->edge = 0;
+	memset(dec->data, 0, sizeof(dec->data));
+}
+
+dht_dec_state_t dht_decoder_feed(dht_decoder_t *dec, unsigned int period, unsigned int low) {
+	if(dec->state != DHT_DEC_BUSY) return dec->state;
+	if(low > period) return dec->state = DHT_DEC_ERROR;
+
+	unsigned int edge = dec->edge++;
+	if(edge == DHT_EDGE_START) return DHT_DEC_BUSY;
+
+	if(edge == DHT_EDGE_RESPONSE) {
+		if(!PERIOD_OK(period, low, DHT_RESPONSE_LOW_US, DHT_RESPONSE_HIGH_US)) dec->state = DHT_DEC_ERROR;
+		return dec->state;
+	}
+
+	unsigned int bit = edge - DHT_EDGE_DATA;
+	/* windows overlap, the shorter 0 is checked first as it is the nearer nominal there */
+	if(PERIOD_OK(period, low, DHT_BIT_LOW_US, DHT_BIT_0_HIGH_US)) {
+		/* 0 */
+	} else if(PERIOD_OK(period, low, DHT_BIT_LOW_US, DHT_BIT_1_HIGH_US)) {
+		dec->data[bit / 8] |= 0x80 >> (bit % 8); /* 1 */
+	} else {
+		return dec->state = DHT_DEC_ERROR;
+	}
+
+	if(bit == DHT_PKT_SIZE * 8 - 1) dec->state = DHT_DEC_DONE;
+	return dec->state;
+}
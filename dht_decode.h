@@ -0,0 +1,40 @@
+#ifndef _DHT_DECODE_H_
+#define _DHT_DECODE_H_
+
+#include <stdint.h>
+
+#define DHT_PKT_SIZE 5
+
+/* nominal timings, us */
+#define DHT_RESPONSE_LOW_US 80
+#define DHT_RESPONSE_HIGH_US 80
+#define DHT_BIT_LOW_US 50
+#define DHT_BIT_0_HIGH_US 27
+#define DHT_BIT_1_HIGH_US 70
+
+/* accepted deviation is 1/DHT_TOLERANCE_DIV of nominal, may be overridden for tuning */
+#ifndef DHT_TOLERANCE_DIV
+#define DHT_TOLERANCE_DIV 2
+#endif
+
+typedef enum {
+	DHT_DEC_BUSY,
+	DHT_DEC_DONE,
+	DHT_DEC_ERROR,
+} dht_dec_state_t;
+
+/*
+Bit decoder fed with one (period, low) capture per falling edge, in microseconds.
+Has no hardware dependencies, so it may run in an interrupt handler or on a host.
+*/
+typedef struct _dht_decoder_t {
+	dht_dec_state_t state;
+	unsigned int edge; /* edges consumed */
+	uint8_t data[DHT_PKT_SIZE];
+} dht_decoder_t;
+
+/*-----------------------------------------------------------------------------*/
+void dht_decoder_reset(dht_decoder_t *dec);
+dht_dec_state_t dht_decoder_feed(dht_decoder_t *dec, unsigned int period, unsigned int low);
+
+#endif
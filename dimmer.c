@@ -1,7 +1,6 @@
 /* AC dimmer control */
 #include <stdint.h>
 #include <stdbool.h>
-#include <string.h>
 
 #include "stm32f10x.h"
 
@@ -10,10 +9,30 @@
 #include "queue.h"
 #include "semphr.h"
 
+#include "filter.h"
+#include "fp.h"
+#include "dimmer.h"
+#include "phase_table.h" /* generated by phase_table.py */
+
 /*-----------------------------------------------------------------------------*/
 /*
 Timer chain:
 TIM1 -> (ITR0) TIM4 -> (ITR3) TIM2
+
+TIM1 captures mains zero-cross input, TIM4 delays its reset until DIMMER_GUARD_US
+before the zero crossing and restarts TIM2, which counts half-periods. Every
+TIM2 channel drives one triac in PWM2 mode: the gate is on from the channel
+firing angle until the guard time before the next zero crossing.
+
+Burst mode channels switch whole mains periods instead: the zero-cross interrupt
+picks the next period on or off and compare preload applies it at the TIM2 restart.
+
+TIM1 overflow means the zero-cross input stopped. It, as well as filtered frequency
+out of AC_FREQ_MIN..AC_FREQ_MAX, forces every gate off until AC_SYNC_PERIODS good
+periods in a row are seen again.
+
+Power changes are slew rate limited: every zero crossing moves each channel at most
+ramp_step towards its set power. Outputs restart from zero after a mains fault.
 */
 /*-----------------------------------------------------------------------------*/
 /* Use TIM1_CH1 (PA8) */
@@ -25,61 +44,107 @@ TIM1 -> (ITR0) TIM4 -> (ITR3) TIM2
 #define ZC_TIMER_CHANNEL TIM_Channel_1
 #define ZC_IRQN TIM1_CC_IRQn
 #define ZC_IRQ_HANDLER TIM1_CC_IRQHandler
+#define ZC_UP_IRQN TIM1_UP_IRQn /* capture timer overflow, no zero crossing for 65 ms */
+#define ZC_UP_IRQ_HANDLER TIM1_UP_IRQHandler
 #define ZC_GET_PCLK_FREQ(x) (((RCC->CFGR >> 11) & 0x7) >= 4 ? (x)->PCLK2_Frequency * 2 : (x)->PCLK2_Frequency)
 #define ZC_IRQ_PRIO (configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY + 1)
 
 /*-----------------------------------------------------------------------------*/
-/* Use TIM4 for phase control */
+/* Use TIM4 for zero crossing alignment */
 #define PHASE_CLK_ENABLE RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM4, ENABLE)
 #define PHASE_TIMER TIM4 /* Uses APB1 clock */
 #define PHASE_GET_PCLK_FREQ(x) (((RCC->CFGR >> 8) & 0x7) >= 4 ? (x)->PCLK1_Frequency * 2 : (x)->PCLK1_Frequency)
 #define PHASE_TRIGGER TIM_TS_ITR0 /* <- TIM1 */
 
 /*-----------------------------------------------------------------------------*/
-/* Use TIM2_CH4 (remapped to PA0) for PWM */
-#define PWM_GPIO GPIOA
-#define PWM_PIN GPIO_Pin_0
+/* Use TIM2 channels (partial remap 2: CH1 PA0, CH2 PA1, CH3 PB10) for triac gates, see dimmer_channels */
 #define PWM_CLK_ENABLE \
 do { \
 	RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE); \
-	RCC_APB2PeriphClockCmd((RCC_APB2Periph_GPIOA | RCC_APB2Periph_AFIO), ENABLE); \
+	RCC_APB2PeriphClockCmd((RCC_APB2Periph_GPIOA | RCC_APB2Periph_GPIOB | RCC_APB2Periph_AFIO), ENABLE); \
 } while(0)
 #define PWM_TIMER TIM2 /* Uses APB1 clock */
-#define PWM_TIMER_CHANNEL_INIT(x) TIM_OC1Init(PWM_TIMER, (x))
-#define PWM_TIMER_CHANNEL_REG CCR1
+#define PWM_GPIO_REMAP GPIO_PartialRemap2_TIM2
 #define PWM_GET_PCLK_FREQ(x) (((RCC->CFGR >> 8) & 0x7) >= 4 ? (x)->PCLK1_Frequency * 2 : (x)->PCLK1_Frequency)
 #define PWM_TRIGGER TIM_TS_ITR3 /* <- TIM4 */
+#define PWM_OFF 0xffff /* compare value never reached */
 
 #define BASE_FREQ 1000000
-#define DIMMER_MAX 100
-#define TRIAC_TRIGGER_PULSE_US 100
+#define DIMMER_GUARD_US 200 /* gate released before zero crossing */
+#define ZC_FILTER_LEN 5 /* zero-cross median window, up to MEDIAN_WINDOW_MAX */
+#define AC_FREQ_MIN 45 /* Hz, mains frequency limits */
+#define AC_FREQ_MAX 65
+#define AC_PERIOD_MIN (BASE_FREQ / AC_FREQ_MAX)
+#define AC_PERIOD_MAX (BASE_FREQ / AC_FREQ_MIN)
+#define AC_SYNC_PERIODS (2 * ZC_FILTER_LEN) /* good periods before outputs are released */
+#define AC_MISSED_MAX 3 /* periods with lost crossings in a row before mains is failed */
 #define DIMMER_PRIO (tskIDLE_PRIORITY + 3)
 #define DIMMER_STACK_SIZE (configMINIMAL_STACK_SIZE + 128)
 
+/* update timers right in the zero-cross interrupt, no dimmer task, set to 0 to use the task */
+#ifndef DIMMER_ISR_ONLY
+#define DIMMER_ISR_ONLY 1
+#endif
+
 /*-----------------------------------------------------------------------------*/
-static volatile unsigned int dimmer_phase = 0;
+typedef struct _dimmer_channel_t dimmer_channel_t;
+
+struct _dimmer_channel_t {
+	GPIO_TypeDef *gpio;
+	uint16_t pin;
+	void (*oc_init)(TIM_TypeDef *tim, TIM_OCInitTypeDef *conf);
+	void (*oc_preload)(TIM_TypeDef *tim, uint16_t preload);
+	volatile uint16_t *ccr;
+};
+
+static const dimmer_channel_t dimmer_channels[DIMMER_CHANNELS] = {
+	{.gpio = GPIOA, .pin = GPIO_Pin_0, .oc_init = TIM_OC1Init, .oc_preload = TIM_OC1PreloadConfig,
+		.ccr = &PWM_TIMER->CCR1,},
+	{.gpio = GPIOA, .pin = GPIO_Pin_1, .oc_init = TIM_OC2Init, .oc_preload = TIM_OC2PreloadConfig,
+		.ccr = &PWM_TIMER->CCR2,},
+	{.gpio = GPIOB, .pin = GPIO_Pin_10, .oc_init = TIM_OC3Init, .oc_preload = TIM_OC3PreloadConfig,
+		.ccr = &PWM_TIMER->CCR3,},
+};
+
+/*-----------------------------------------------------------------------------*/
+static volatile unsigned int dimmer_value[DIMMER_CHANNELS]; /* power steps */
+static volatile unsigned int dimmer_target[DIMMER_CHANNELS]; /* set power, steps */
+static volatile unsigned int ramp_step = 0; /* steps per mains period, 0 - no ramp */
+static volatile unsigned int dimmer_phase[DIMMER_CHANNELS]; /* firing delay, PHASE_TABLE_SCALE is a half-period */
+static volatile dimmer_mode_t dimmer_mode[DIMMER_CHANNELS];
+static unsigned int burst_acc[DIMMER_CHANNELS]; /* sigma-delta accumulator, DIMMER_STEPS is one period */
+static volatile unsigned int ac_half = 0; /* filtered half-period */
 static volatile unsigned int ac_period = 0;
 static volatile unsigned int ac_high = 0;
+static unsigned int ac_filtered = 0; /* filtered period */
+static unsigned int ac_sync = 0; /* good periods in a row */
+static unsigned int ac_missed = 0; /* periods with lost crossings in a row */
+static volatile bool ac_resync = true; /* next capture follows a gap, discard it */
 
-static xSemaphoreHandle irq_sem;
+static volatile mains_stat_t mains = {.fault = true,};
+static const unsigned int jitter_bins[MAINS_JITTER_BINS - 1] = {10, 25, 50, 100};
 
-static const uint16_t acostab[DIMMER_MAX - 1] = {
-	959, 931, 911, 893, 877, 863, 849, 837, 825, 814, 804, 793, 784, 774,
-	765, 756, 747, 738, 730, 722, 714, 706, 698, 690, 683, 675, 668, 661, 653, 646,
-	639, 632, 625, 618, 611, 605, 598, 591, 584, 578, 571, 564, 558, 551, 545, 538,
-	532, 525, 519, 512, 505, 499, 492, 486, 479, 473, 466, 460, 453, 446, 440, 433,
-	426, 419, 413, 406, 399, 392, 385, 378, 371, 363, 356, 349, 341, 334, 326, 318,
-	310, 302, 294, 286, 277, 268, 259, 250, 240, 231, 220, 210, 199, 187, 175, 161,
-	147, 131, 113, 93, 65
-};
+static median_t period_filter;
+static median_t high_filter;
+
+#if !DIMMER_ISR_ONLY
+static xSemaphoreHandle irq_sem;
+#endif
 
+#if !DIMMER_ISR_ONLY
 static void dimmer_thread(void *data);
+#endif
 /*-----------------------------------------------------------------------------*/
 void dimmer_init() {
+	median_init(&period_filter, ZC_FILTER_LEN);
+	median_init(&high_filter, ZC_FILTER_LEN);
+
+#if !DIMMER_ISR_ONLY
 	/* Create task */
 	vSemaphoreCreateBinary(irq_sem);
 	xSemaphoreTake(irq_sem, 0);
 	xTaskCreate(dimmer_thread, (const signed char *)"Dimmer", DIMMER_STACK_SIZE, NULL, DIMMER_PRIO, NULL);
+#endif
 
 	/* Enable clocks */
 	ZC_CLK_ENABLE;
@@ -97,9 +162,12 @@ void dimmer_init() {
 	GPIO_PinRemapConfig(ZC_GPIO_REMAP, ENABLE);
 #endif
 
-	gpconf.GPIO_Pin = PWM_PIN;
+	int i;
 	gpconf.GPIO_Mode = GPIO_Mode_AF_PP;
-	GPIO_Init(PWM_GPIO, &gpconf);
+	for(i = 0; i < DIMMER_CHANNELS; i++) {
+		gpconf.GPIO_Pin = dimmer_channels[i].pin;
+		GPIO_Init(dimmer_channels[i].gpio, &gpconf);
+	}
 #ifdef PWM_GPIO_REMAP
 	GPIO_PinRemapConfig(PWM_GPIO_REMAP, ENABLE);
 #endif
@@ -112,6 +180,8 @@ void dimmer_init() {
 		.NVIC_IRQChannelCmd = ENABLE,
 	};
 	NVIC_Init(&itconf);
+	itconf.NVIC_IRQChannel = ZC_UP_IRQN;
+	NVIC_Init(&itconf);
 
 	/* PWM capture configuration */
 	/* Give 1us resolution */
@@ -134,6 +204,8 @@ void dimmer_init() {
 	TIM_SelectSlaveMode(ZC_TIMER, TIM_SlaveMode_Reset); /* Select the slave Mode: Reset Mode */
 	TIM_SelectMasterSlaveMode(ZC_TIMER, TIM_MasterSlaveMode_Enable); /* Enable the Master/Slave Mode */
 
+	TIM_UpdateRequestConfig(ZC_TIMER, TIM_UpdateSource_Regular); /* overflow only, not reset by zero crossing */
+
 	ZC_TIMER->CNT = 0;
 	ZC_TIMER->ARR = 0xffff;
 
@@ -154,14 +226,18 @@ void dimmer_init() {
 	freq = PWM_GET_PCLK_FREQ(&clocks);
 	TIM_PrescalerConfig(PWM_TIMER, freq / BASE_FREQ - 1, TIM_PSCReloadMode_Immediate);
 
-	/* PWM1 Mode configuration: Channel1 */
+	/* PWM2 Mode configuration: active from compare value to the end of half-period */
 	TIM_OCInitTypeDef occonf = {
-		.TIM_OCMode = TIM_OCMode_PWM1,
+		.TIM_OCMode = TIM_OCMode_PWM2,
 		.TIM_OutputState = TIM_OutputState_Enable,
-		.TIM_Pulse = 0, /* disabled initially */
+		.TIM_Pulse = PWM_OFF, /* disabled initially */
 		.TIM_OCPolarity = TIM_OCPolarity_High,
 	};
-	PWM_TIMER_CHANNEL_INIT(&occonf);
+	for(i = 0; i < DIMMER_CHANNELS; i++) {
+		dimmer_channels[i].oc_init(PWM_TIMER, &occonf);
+		/* new compare values take effect on the next half-period */
+		dimmer_channels[i].oc_preload(PWM_TIMER, TIM_OCPreload_Enable);
+	}
 
 	TIM_SelectInputTrigger(PWM_TIMER, PWM_TRIGGER); /* connect to phase timer */
 	TIM_SelectSlaveMode(PWM_TIMER, TIM_SlaveMode_Reset); /* Select the slave Mode: Reset Mode */
@@ -171,77 +247,245 @@ void dimmer_init() {
 	PWM_TIMER->ARR = 0xffff; /* initial value */
 
 	/* Start ZC timer */
-	ZC_TIMER->DIER |= TIM_IT_CC1;
-	ZC_TIMER->SR = ~TIM_FLAG_CC1;
+	ZC_TIMER->DIER |= TIM_IT_CC1 | TIM_IT_Update;
+	ZC_TIMER->SR = ~(TIM_FLAG_CC1 | TIM_FLAG_Update);
     ZC_TIMER->CR1 |= TIM_CR1_CEN;
 
 	/* Start PWM timer */
     PWM_TIMER->CR1 |= TIM_CR1_CEN;
 }
 
-void dimmer_set(unsigned int val) {
-	if(val >= DIMMER_MAX) {
+/* linear interpolation between table entries, steps in 1..DIMMER_STEPS - 1 */
+static unsigned int power_to_phase(unsigned int steps) {
+	unsigned int pos = steps * (PHASE_TABLE_SIZE - 1);
+	unsigned int idx = pos / DIMMER_STEPS;
+	unsigned int frac = pos % DIMMER_STEPS;
+
+	unsigned int a = phase_table[idx];
+	unsigned int b = phase_table[idx + 1];
+	return a - ((a - b) * frac) / DIMMER_STEPS;
+}
+
+/*
+Channel compare value for the current half-period. The delay spans the whole half-period
+from the zero crossing, which is DIMMER_GUARD_US into it. Firing after the gate release,
+guard time before the next crossing, is no firing at all.
+*/
+static inline unsigned int phase_to_ccr(unsigned int phase, unsigned int half) {
+	unsigned int delay = (phase * half) >> 16;
+	if(delay >= half - DIMMER_GUARD_US) return PWM_OFF;
+	return DIMMER_GUARD_US + delay;
+}
+
+/*
+Update channel compare value for new power or mode.
+Task callers hold a critical section, so the zero-cross interrupt can't
+force the failsafe between the fault check and the compare write.
+*/
+static void dimmer_apply(int channel) {
+	unsigned int steps = dimmer_value[channel];
+	volatile uint16_t *ccr = dimmer_channels[channel].ccr;
+
+	if(mains.fault) {
+		/* failsafe, released on zero crossing */
+		*ccr = PWM_OFF;
+	} else if(steps >= DIMMER_STEPS) {
 		/* always on */
-		PWM_TIMER->PWM_TIMER_CHANNEL_REG = 0xffff;
-	} else if(!val) {
+		*ccr = 0;
+	} else if(!steps) {
 		/* always off */
-		PWM_TIMER->PWM_TIMER_CHANNEL_REG = 0;
+		*ccr = PWM_OFF;
+	} else if(dimmer_mode[channel] == DIMMER_PHASE) {
+		unsigned int phase = power_to_phase(steps);
+		dimmer_phase[channel] = phase;
+		*ccr = phase_to_ccr(phase, ac_half);
+	}
+	/* burst mode cycles are picked on zero crossing */
+}
+
+/* move channel power towards the set one, once per mains period */
+static void dimmer_ramp(int channel) {
+	unsigned int value = dimmer_value[channel];
+	unsigned int target = dimmer_target[channel];
+	if(value == target) return;
+
+	unsigned int step = ramp_step ? ramp_step : DIMMER_STEPS;
+	if(value < target) {
+		value = target - value > step ? value + step : target;
 	} else {
-		PWM_TIMER->PWM_TIMER_CHANNEL_REG = TRIAC_TRIGGER_PULSE_US;
-		dimmer_phase = acostab[val - 1];
+		value = value - target > step ? value - step : target;
 	}
+
+	dimmer_value[channel] = value;
+	dimmer_apply(channel);
 }
 
-/* optimized median of 5 */
-#define SWAP_IF_GREATER(a,b) \
-do { \
-	if((a) > (b)) { \
-		unsigned int temp = (a); \
-		(a) = (b); \
-		(b) = temp; \
-	} \
-} while(0)
+void dimmer_set(int channel, fixed_t val) {
+	if(channel < 0 || channel >= DIMMER_CHANNELS) return;
 
-static inline unsigned int opt_med5(unsigned int *p) {
-	SWAP_IF_GREATER(p[0],p[1]);
-	SWAP_IF_GREATER(p[3],p[4]);
-	SWAP_IF_GREATER(p[0],p[3]);
-	SWAP_IF_GREATER(p[1],p[4]);
-	SWAP_IF_GREATER(p[1],p[2]);
-	SWAP_IF_GREATER(p[2],p[3]);
-	SWAP_IF_GREATER(p[1],p[2]);
+	if(val < DIMMER_MIN * FP_ONE) val = DIMMER_MIN * FP_ONE;
+	if(val > DIMMER_MAX * FP_ONE) val = DIMMER_MAX * FP_ONE;
 
-	return p[2];
+	unsigned int steps = ((val - DIMMER_MIN * FP_ONE) * DIMMER_STEPS / (DIMMER_MAX - DIMMER_MIN) + FP_ONE / 2) >> FP_FRACT_BITS;
+	/* ramp state is stepped by the zero-cross interrupt */
+	taskENTER_CRITICAL();
+	dimmer_target[channel] = steps;
+	if(!ramp_step) {
+		/* no ramp, apply right away */
+		dimmer_value[channel] = steps;
+		dimmer_apply(channel);
+	}
+	taskEXIT_CRITICAL();
 }
 
-static void dimmer_thread(void *data) {
-	unsigned int prev_period[5] = {0, 0, 0, 0, 0};
-	unsigned int prev_high[5] = {0, 0, 0, 0, 0};
-	int idx = 0;
+fixed_t dimmer_get(int channel) {
+	if(channel < 0 || channel >= DIMMER_CHANNELS) return 0;
+	return DIMMER_MIN * FP_ONE + ((dimmer_value[channel] * (DIMMER_MAX - DIMMER_MIN)) << FP_FRACT_BITS) / DIMMER_STEPS;
+}
 
-	while(1) {
-		/* wait for interrupt */
-		xSemaphoreTake(irq_sem, portMAX_DELAY);
+void dimmer_set_ramp(fixed_t rate) {
+	if(rate < 0) rate = 0;
+	if(rate > (DIMMER_MAX - DIMMER_MIN) * FP_ONE) rate = (DIMMER_MAX - DIMMER_MIN) * FP_ONE;
 
-		/* median filter */
-		prev_period[idx] = ac_period;
-		prev_high[idx] = ac_high;
-		if(idx++ == 5) idx = 0;
+	unsigned int steps = (rate * DIMMER_STEPS / (DIMMER_MAX - DIMMER_MIN) + FP_ONE / 2) >> FP_FRACT_BITS;
+	taskENTER_CRITICAL();
+	/* slowest ramp is one step per period */
+	ramp_step = (!steps && rate) ? 1 : steps;
+	taskEXIT_CRITICAL();
+}
 
-		unsigned int sorted_period[5];
-		unsigned int sorted_high[5];
+fixed_t dimmer_get_ramp() {
+	return ((ramp_step * (DIMMER_MAX - DIMMER_MIN)) << FP_FRACT_BITS) / DIMMER_STEPS;
+}
 
-		memcpy(sorted_period, prev_period, sizeof(unsigned int) * 5);
-		memcpy(sorted_high, prev_high, sizeof(unsigned int) * 5);
+void dimmer_set_mode(int channel, dimmer_mode_t mode) {
+	if(channel < 0 || channel >= DIMMER_CHANNELS) return;
 
-		unsigned int half = opt_med5(sorted_period) >> 1;
-		unsigned int high = opt_med5(sorted_high);
+	taskENTER_CRITICAL();
+	dimmer_mode[channel] = mode;
+	burst_acc[channel] = 0;
+	dimmer_apply(channel);
+	taskEXIT_CRITICAL();
+}
+
+dimmer_mode_t dimmer_get_mode(int channel) {
+	if(channel < 0 || channel >= DIMMER_CHANNELS) return DIMMER_PHASE;
+	return dimmer_mode[channel];
+}
 
-		PWM_TIMER->ARR = half - 1; /* correct period */
-		PHASE_TIMER->ARR = ((high - half) >> 1) + ((dimmer_phase * half) >> 10); /* correct phase */
+void dimmer_get_mains(mains_stat_t *stat) {
+	stat->freq = mains.freq;
+	stat->fault = mains.fault;
+	stat->missed = mains.missed;
+	stat->timeouts = mains.timeouts;
+	stat->faults = mains.faults;
+
+	int i;
+	for(i = 0; i < MAINS_JITTER_BINS; i++) stat->jitter[i] = mains.jitter[i];
+}
+
+/* force every gate off until mains is back in limits */
+static void mains_fail() {
+	if(!mains.fault) mains.faults++;
+	mains.fault = true;
+	ac_sync = 0;
+	ac_missed = 0;
+
+	int i;
+	for(i = 0; i < DIMMER_CHANNELS; i++) {
+		*dimmer_channels[i].ccr = PWM_OFF;
+		dimmer_value[i] = 0; /* soft start on recovery */
 	}
 }
 
+/* filter zero-cross capture and correct PWM period and triac phases, once per mains period */
+static void zero_cross_update(unsigned int period, unsigned int high_time) {
+	if(ac_resync) {
+		/* capture timer overflowed since the previous crossing */
+		ac_resync = false;
+		return;
+	}
+
+	if(ac_sync >= ZC_FILTER_LEN && period > ac_filtered * 3 / 2) {
+		/* crossings lost in between, keep them out of the filter unless it goes on */
+		mains.missed += (period + ac_filtered / 2) / ac_filtered - 1;
+		if(++ac_missed >= AC_MISSED_MAX) mains_fail();
+		return;
+	}
+	ac_missed = 0;
+
+	/* median filter */
+	unsigned int filtered = median_update(&period_filter, period);
+	unsigned int high = median_update(&high_filter, high_time);
+	unsigned int half = filtered >> 1;
+
+	if(ac_sync >= ZC_FILTER_LEN) {
+		unsigned int dev = period > filtered ? period - filtered : filtered - period;
+		unsigned int bin = 0;
+		while(bin < MAINS_JITTER_BINS - 1 && dev >= jitter_bins[bin]) bin++;
+		mains.jitter[bin]++;
+	}
+
+	ac_filtered = filtered;
+	mains.freq = FP_DIV(BASE_FREQ, filtered);
+	if(filtered < AC_PERIOD_MIN || filtered > AC_PERIOD_MAX) {
+		mains_fail();
+		return;
+	}
+
+	/* zero crossing is in the middle of input duty cycle excess, restart half-periods guard time before it */
+	int offset = ((int)high - (int)half) / 2 - DIMMER_GUARD_US;
+	while(offset < 0) offset += half;
+
+	ac_half = half;
+	PWM_TIMER->ARR = half - 1; /* correct period */
+	PHASE_TIMER->ARR = offset; /* correct zero crossing */
+
+	int i;
+	if(ac_sync < AC_SYNC_PERIODS) {
+		if(++ac_sync < AC_SYNC_PERIODS) return;
+
+		/* mains is stable, release outputs */
+		mains.fault = false;
+		for(i = 0; i < DIMMER_CHANNELS; i++) dimmer_apply(i);
+	}
+
+	/* same zero crossing for every channel */
+	for(i = 0; i < DIMMER_CHANNELS; i++) {
+		dimmer_ramp(i);
+
+		unsigned int steps = dimmer_value[i];
+		if(!steps || steps >= DIMMER_STEPS) continue;
+
+		if(dimmer_mode[i] == DIMMER_BURST) {
+			/* first order sigma-delta, steps on-periods out of every DIMMER_STEPS spread evenly */
+			burst_acc[i] += steps;
+			if(burst_acc[i] >= DIMMER_STEPS) {
+				burst_acc[i] -= DIMMER_STEPS;
+				*dimmer_channels[i].ccr = 0;
+			} else {
+				*dimmer_channels[i].ccr = PWM_OFF;
+			}
+		} else {
+			*dimmer_channels[i].ccr = phase_to_ccr(dimmer_phase[i], half);
+		}
+	}
+}
+
+#if !DIMMER_ISR_ONLY
+static void dimmer_thread(void *data) {
+	while(1) {
+		/* wait for interrupt */
+		xSemaphoreTake(irq_sem, portMAX_DELAY);
+
+		/* capture timer overflow interrupt may force the failsafe */
+		taskENTER_CRITICAL();
+		zero_cross_update(ac_period, ac_high);
+		taskEXIT_CRITICAL();
+	}
+}
+#endif
+
 /*-----------------------------------------------------------------------------*/
 void ZC_IRQ_HANDLER(void) {
 	portBASE_TYPE preempt = pdFALSE;
@@ -252,7 +496,24 @@ void ZC_IRQ_HANDLER(void) {
 
 		ZC_TIMER->SR = ~TIM_FLAG_CC1;
 
+#if DIMMER_ISR_ONLY
+		zero_cross_update(ac_period, ac_high);
+#else
 		xSemaphoreGiveFromISR(irq_sem, &preempt);
+#endif
 	}
 	portEND_SWITCHING_ISR(preempt);
 }
+
+/* no zero crossing for the whole capture timer period */
+void ZC_UP_IRQ_HANDLER(void) {
+	if(ZC_TIMER->SR & TIM_FLAG_Update) {
+		ZC_TIMER->SR = ~TIM_FLAG_Update;
+
+		/* counts once per gap, overflows repeat while the input is lost */
+		if(!ac_resync) mains.timeouts++;
+		ac_resync = true;
+		mains.freq = 0;
+		mains_fail();
+	}
+}
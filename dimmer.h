@@ -1,10 +1,38 @@
 #ifndef _DIMMER_H_
 #define _DIMMER_H_
 
+#include <stdbool.h>
+#include "fp.h"
+
 #define DIMMER_MAX 100
 #define DIMMER_MIN 0
+#define DIMMER_STEPS 1000 /* output resolution, power steps over DIMMER_MIN..DIMMER_MAX */
+#define DIMMER_CHANNELS 3 /* loads sharing the zero-cross detector */
+
+typedef enum {
+	DIMMER_PHASE, /* phase angle control, every half-period */
+	DIMMER_BURST, /* integral cycle control, whole mains periods on or off */
+} dimmer_mode_t;
+
+/* period deviation from the filtered one, bins up to 10, 25, 50, 100 us and above */
+#define MAINS_JITTER_BINS 5
+
+typedef struct _mains_stat_t {
+	fixed_t freq; /* filtered mains frequency, Hz */
+	bool fault; /* outputs forced off */
+	unsigned long missed; /* zero crossings lost between captures */
+	unsigned long timeouts; /* zero-cross input stopped */
+	unsigned long faults; /* failsafe activations */
+	unsigned long jitter[MAINS_JITTER_BINS];
+} mains_stat_t;
 
 void dimmer_init();
-void dimmer_set(unsigned int val); /* 0..100 */
+void dimmer_set(int channel, fixed_t val); /* RMS power, DIMMER_MIN..DIMMER_MAX percent */
+fixed_t dimmer_get(int channel); /* current power, follows the set one at ramp rate */
+void dimmer_set_ramp(fixed_t rate); /* percent per mains period, 0 - immediate */
+fixed_t dimmer_get_ramp();
+void dimmer_set_mode(int channel, dimmer_mode_t mode);
+dimmer_mode_t dimmer_get_mode(int channel);
+void dimmer_get_mains(mains_stat_t *stat);
 
 #endif
@@ -0,0 +1,59 @@
+/* Sample filters */
+#include "filter.h"
+
+void median_init(median_t *m, unsigned int len) {
+	if(len < 1) len = 1;
+	if(len > MEDIAN_WINDOW_MAX) len = MEDIAN_WINDOW_MAX;
+
+	m->len = len;
+	m->count = 0;
+	m->idx = 0;
+}
+
+int32_t median_update(median_t *m, int32_t x) {
+	unsigned int i;
+
+	if(m->count == m->len) {
+		/* drop the oldest sample */
+		int32_t old = m->hist[m->idx];
+		for(i = 0; m->sorted[i] != old; i++);
+		for(; i < m->count - 1; i++) m->sorted[i] = m->sorted[i + 1];
+		m->count--;
+	}
+
+	/* insert in place */
+	for(i = m->count; i > 0 && m->sorted[i - 1] > x; i--) m->sorted[i] = m->sorted[i - 1];
+	m->sorted[i] = x;
+	m->count++;
+
+	m->hist[m->idx] = x;
+	if(++m->idx == m->len) m->idx = 0;
+
+	return m->sorted[m->count / 2];
+}
+
+void filter_reset(filter_t *f) {
+	f->started = false;
+	f->ema = 0;
+}
+
+fixed_t filter_update(filter_t *f, fixed_t x, unsigned int median_len, fixed_t alpha) {
+	if(median_len < 1) median_len = 1;
+	if(median_len > FILTER_MEDIAN_MAX) median_len = FILTER_MEDIAN_MAX;
+	if(alpha <= 0 || alpha > FP_ONE) alpha = FP_ONE;
+
+	/* window changed, refill it */
+	if(!f->started || f->median.len != median_len) median_init(&f->median, median_len);
+
+	fixed_t m = median_update(&f->median, x);
+
+	/* start from the first sample instead of zero */
+	if(!f->started) {
+		f->ema = m;
+		f->started = true;
+	} else {
+		f->ema += FP_MUL(alpha, m - f->ema);
+	}
+
+	return f->ema;
+}
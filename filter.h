@@ -0,0 +1,41 @@
+#ifndef _FILTER_H_
+#define _FILTER_H_
+
+#include <stdbool.h>
+#include "fp.h"
+
+#define FILTER_MEDIAN_MAX 5
+#define MEDIAN_WINDOW_MAX 9
+
+/*
+Running median over a fixed window, the sorted copy is kept up to date:
+the oldest sample is removed and the new one inserted in place, no resorting.
+That is O(N) shifting per sample rather than constant time, for windows up to
+MEDIAN_WINDOW_MAX it costs a few dozen compares and is cheaper than a heap pair.
+Has no RTOS dependencies and may be updated from an interrupt handler.
+*/
+typedef struct _median_t {
+	unsigned int len; /* window length */
+	unsigned int count;
+	unsigned int idx; /* oldest sample */
+	int32_t hist[MEDIAN_WINDOW_MAX]; /* arrival order */
+	int32_t sorted[MEDIAN_WINDOW_MAX];
+} median_t;
+
+/* median of last N samples for outlier rejection, followed by exponential smoothing */
+typedef struct _filter_t {
+	median_t median;
+	bool started;
+	fixed_t ema;
+} filter_t;
+
+/*-----------------------------------------------------------------------------*/
+void median_init(median_t *m, unsigned int len);
+/* returns median of the window, of the samples seen so far until it is filled */
+int32_t median_update(median_t *m, int32_t x);
+
+void filter_reset(filter_t *f);
+/* median_len 1 disables median, alpha FP_ONE disables smoothing */
+fixed_t filter_update(filter_t *f, fixed_t x, unsigned int median_len, fixed_t alpha);
+
+#endif
@@ -0,0 +1,24 @@
+/* Flash controller access shared by configuration and record log */
+#include "stm32f10x.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#include "flash.h"
+
+static xSemaphoreHandle flash_mutex;
+
+void flash_init() {
+	flash_mutex = xSemaphoreCreateMutex();
+}
+
+void flash_begin() {
+	xSemaphoreTake(flash_mutex, portMAX_DELAY);
+	FLASH_Unlock();
+}
+
+void flash_end() {
+	FLASH_Lock();
+	xSemaphoreGive(flash_mutex);
+}
@@ -0,0 +1,46 @@
+#ifndef _FLASH_H_
+#define _FLASH_H_
+
+#include "stm32f10x.h"
+
+extern char _eimage; /* from linker */
+
+#if defined(STM32F10X_HD) || defined(STM32F10X_HD_VL) || defined(STM32F10X_CL) || defined(STM32F10X_XL)
+	#define FLASH_PAGE_SIZE 0x800
+#else
+	#define FLASH_PAGE_SIZE 0x400
+#endif
+
+#if defined(STM32F10X_LD) || defined(STM32F10X_LD_VL)
+	#define FLASH_SIZE 0x008000
+#elif defined(STM32F10X_MD) || defined(STM32F10X_MD_VL)
+	#define FLASH_SIZE 0x020000
+#elif defined(STM32F10X_CL)
+	#define FLASH_SIZE 0x040000
+#elif defined(STM32F10X_HD) || defined(STM32F10X_HD_VL)
+	#define FLASH_SIZE 0x080000
+#elif defined(STM32F10X_XL)
+	#define FLASH_SIZE 0x100000
+#endif
+
+#define FLASH_END (FLASH_BASE + FLASH_SIZE)
+
+/*
+Flash after the image:
+[_eimage, page aligned) config images | [FLOG_AREA_START_ADDR, FLASH_END) record log
+*/
+#define FLOG_AREA_PAGES 16
+#define FLOG_AREA_START_ADDR (FLASH_END - FLOG_AREA_PAGES * FLASH_PAGE_SIZE)
+
+#define CONF_AREA_START_ADDR (((unsigned long)&_eimage + FLASH_PAGE_SIZE - 1) & ~((unsigned long)FLASH_PAGE_SIZE - 1))
+#define CONF_AREA_END_ADDR FLOG_AREA_START_ADDR
+
+void flash_init();
+/*
+Unlock controller for a program or erase sequence and lock it back.
+Writers are serialized, one can't lock the controller under another.
+*/
+void flash_begin();
+void flash_end();
+
+#endif /* _FLASH_H_ */
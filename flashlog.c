@@ -0,0 +1,251 @@
+/*
+Append-only record log in the flash area reserved at the end of flash.
+Pages are written round-robin, so wear is spread evenly, and the oldest page
+is erased when the log wraps around. Each page starts with a header slot
+holding a sequence number, the page with the highest one is the current.
+Every record carries a CRC, a record torn by power loss fails the check and
+is skipped, the next boot continues after the last programmed slot.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "stm32f10x.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+
+#include "flash.h"
+#include "crc.h"
+#include "flashlog.h"
+
+#define FLOG_PAGES FLOG_AREA_PAGES
+#define FLOG_SLOTS (FLASH_PAGE_SIZE / sizeof(flog_rec_t)) /* slot 0 is the page header */
+#define FLOG_MAGIC 0x474f4c46 /* "FLOG" */
+#define FLOG_ERASED 0xffffffff
+
+#define FLOG_QUEUE_LEN 4
+#define FLOG_PRIO tskIDLE_PRIORITY
+#define FLOG_STACK_SIZE configMINIMAL_STACK_SIZE
+
+typedef struct _flog_hdr_t {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t seq_inv;
+	uint32_t reserved;
+} flog_hdr_t;
+
+static void flog_thread(void *arg);
+/*-----------------------------------------------------------------------------*/
+static xQueueHandle rec_queue;
+static uint32_t page_seq[FLOG_PAGES]; /* 0 if page has no valid header */
+static uint32_t page_time[FLOG_PAGES]; /* first record time, FLOG_ERASED if none */
+static volatile unsigned int cur_page;
+static volatile unsigned int cur_slot; /* next free slot, FLOG_SLOTS if a new page is needed */
+static uint32_t next_seq = 1;
+static volatile unsigned long write_errors;
+/*-----------------------------------------------------------------------------*/
+
+static inline const flog_rec_t *slot_addr(unsigned int page, unsigned int slot) {
+	return (const flog_rec_t*)(FLOG_AREA_START_ADDR + page * FLASH_PAGE_SIZE) + slot;
+}
+
+static inline bool slot_blank(const flog_rec_t *rec) {
+	const uint32_t *p = (const uint32_t*)rec;
+	unsigned int i;
+	for(i = 0; i < sizeof(flog_rec_t) / 4; i++)
+		if(p[i] != FLOG_ERASED) return false;
+	return true;
+}
+
+static inline uint32_t rec_crc(const flog_rec_t *rec) {
+	return crc32_calc((const uint32_t*)rec, sizeof(flog_rec_t) / 4 - 1);
+}
+
+static inline bool rec_valid(const flog_rec_t *rec) {
+	return rec->time != FLOG_ERASED && rec->crc == rec_crc(rec);
+}
+
+/* logical page k, 0 is the oldest */
+static inline unsigned int page_at(unsigned int first, unsigned int k) {
+	return (first + k) % FLOG_PAGES;
+}
+
+static void scan_page(unsigned int page) {
+	const flog_hdr_t *hdr = (const flog_hdr_t*)slot_addr(page, 0);
+
+	page_seq[page] = 0;
+	page_time[page] = FLOG_ERASED;
+	if(hdr->magic != FLOG_MAGIC || hdr->seq != ~hdr->seq_inv) return;
+
+	page_seq[page] = hdr->seq;
+
+	unsigned int slot;
+	for(slot = 1; slot < FLOG_SLOTS; slot++) {
+		const flog_rec_t *rec = slot_addr(page, slot);
+		if(rec_valid(rec)) {
+			page_time[page] = rec->time;
+			break;
+		}
+	}
+}
+
+int flog_init() {
+	unsigned int page;
+
+	/* find current page */
+	cur_page = FLOG_PAGES - 1; /* first append starts from page 0 */
+	cur_slot = FLOG_SLOTS;
+	for(page = 0; page < FLOG_PAGES; page++) {
+		scan_page(page);
+		if(page_seq[page] && page_seq[page] >= next_seq) {
+			next_seq = page_seq[page] + 1;
+			cur_page = page;
+		}
+	}
+
+	/* continue after the last programmed slot, torn records are left behind */
+	if(page_seq[cur_page]) {
+		unsigned int slot = FLOG_SLOTS;
+		while(slot > 1 && slot_blank(slot_addr(cur_page, slot - 1))) slot--;
+		cur_slot = slot;
+	}
+
+	if((rec_queue = xQueueCreate(FLOG_QUEUE_LEN, sizeof(flog_rec_t))) == NULL) return -1;
+	xTaskCreate(flog_thread, (const signed char *)"FLog", FLOG_STACK_SIZE, NULL, FLOG_PRIO, NULL);
+
+	return 0;
+}
+
+int flog_append(const flog_rec_t *rec) {
+	if(!rec_queue) return -1;
+	return xQueueSend(rec_queue, rec, 0) ? 0 : -1;
+}
+
+static FLASH_Status program(unsigned long addr, const void *data, unsigned int size) {
+	const uint32_t *ptr32 = data;
+	FLASH_Status status = FLASH_COMPLETE;
+
+	while(status == FLASH_COMPLETE && size) {
+		status = FLASH_ProgramWord(addr, *(ptr32++));
+		addr += 4;
+		size -= 4;
+	}
+
+	return status;
+}
+
+/* erase the oldest page and make it current */
+static FLASH_Status next_page() {
+	unsigned int page = (cur_page + 1) % FLOG_PAGES;
+	unsigned long addr = (unsigned long)slot_addr(page, 0);
+
+	page_seq[page] = 0;
+	page_time[page] = FLOG_ERASED;
+
+	FLASH_Status status = FLASH_ErasePage(addr);
+	if(status != FLASH_COMPLETE) return status;
+
+	flog_hdr_t hdr = {
+		.magic = FLOG_MAGIC,
+		.seq = next_seq,
+		.seq_inv = ~next_seq,
+		.reserved = FLOG_ERASED,
+	};
+	status = program(addr, &hdr, sizeof(hdr));
+	if(status != FLASH_COMPLETE) return status;
+
+	page_seq[page] = next_seq++;
+	cur_slot = 1;
+	cur_page = page;
+
+	return FLASH_COMPLETE;
+}
+
+static void flog_thread(void *arg) {
+	while(1) {
+		flog_rec_t rec;
+		if(!xQueueReceive(rec_queue, &rec, portMAX_DELAY)) continue;
+
+		rec.reserved = 0xffff;
+		rec.crc = rec_crc(&rec);
+
+		/*
+		saveconf waits for the controller. A page erase (up to 40 ms) or program stalls every
+		flash fetch, interrupt handlers included: zero-cross captures in that time are not
+		handled, the dimmer timers keep firing with the last correction for up to two mains
+		periods. The capture timer keeps only the latest period, these aren't counted as missed.
+		*/
+		flash_begin();
+
+		FLASH_Status status = FLASH_COMPLETE;
+		if(cur_slot >= FLOG_SLOTS) status = next_page();
+
+		if(status == FLASH_COMPLETE) {
+			const flog_rec_t *dst = slot_addr(cur_page, cur_slot++);
+			status = program((unsigned long)dst, &rec, sizeof(rec));
+			if(status == FLASH_COMPLETE && memcmp(dst, &rec, sizeof(rec))) status = FLASH_ERROR_PG;
+			if(status == FLASH_COMPLETE && page_time[cur_page] == FLOG_ERASED) page_time[cur_page] = rec.time;
+		}
+
+		flash_end();
+
+		if(status != FLASH_COMPLETE) write_errors++;
+	}
+}
+
+void flog_seek(uint32_t time, flog_iter_t *it) {
+	unsigned int first = (cur_page + 1) % FLOG_PAGES;
+
+	/* binary search for the last page starting not later than time, blank pages are the oldest */
+	unsigned int lo = 0, hi = FLOG_PAGES;
+	while(lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		unsigned int page = page_at(first, mid);
+		uint32_t t = page_seq[page] ? page_time[page] : 0;
+		if(t <= time) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	it->first = first;
+	it->page = lo ? lo - 1 : 0;
+	it->slot = 1;
+
+	/* skip older records within the page */
+	flog_iter_t pos = *it;
+	flog_rec_t rec;
+	while(!flog_next(&pos, &rec)) {
+		if(rec.time >= time) break;
+		*it = pos;
+	}
+}
+
+int flog_next(flog_iter_t *it, flog_rec_t *rec) {
+	while(it->page < FLOG_PAGES) {
+		unsigned int page = page_at(it->first, it->page);
+
+		if(!page_seq[page] || it->slot >= FLOG_SLOTS) {
+			it->page++;
+			it->slot = 1;
+			continue;
+		}
+
+		const flog_rec_t *src = slot_addr(page, it->slot++);
+		if(slot_blank(src)) {
+			if(page == cur_page) break; /* end of log */
+			continue;
+		}
+
+		*rec = *src;
+		if(rec_valid(rec)) return 0;
+	}
+
+	return -1;
+}
+
+unsigned long flog_errors() {
+	return write_errors;
+}
@@ -0,0 +1,34 @@
+#ifndef _FLASHLOG_H_
+#define _FLASHLOG_H_
+
+#include <stdint.h>
+
+/* one record per slot, erased slot reads all ones */
+typedef struct _flog_rec_t {
+	uint32_t time; /* RTC counter */
+	int16_t temperature; /* 1/10 deg C */
+	int16_t humidity; /* 1/10 % */
+	uint8_t dimmer;
+	uint8_t light;
+	uint16_t reserved;
+	uint32_t crc;
+} flog_rec_t __attribute__((aligned(4)));
+
+/* read position, pages are visited oldest first */
+typedef struct _flog_iter_t {
+	unsigned int first; /* oldest page at seek time */
+	unsigned int page; /* logical page index */
+	unsigned int slot;
+} flog_iter_t;
+
+/*-----------------------------------------------------------------------------*/
+int flog_init();
+/* queue record for writing, does not block, returns -1 if the queue is full */
+int flog_append(const flog_rec_t *rec);
+/* position at the first record not older than time */
+void flog_seek(uint32_t time, flog_iter_t *it);
+/* returns -1 at the end of log */
+int flog_next(flog_iter_t *it, flog_rec_t *rec);
+unsigned long flog_errors();
+
+#endif
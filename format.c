@@ -0,0 +1,133 @@
+#include <stdbool.h>
+#include <stdarg.h>
+
+#include "format.h"
+
+/* streaming printf core */
+#define IS_DIGIT(a) ((a) >= '0' && (a) <= '9')
+#define DIGIT(a) ((a) - '0')
+#define NUM_BUF_LEN 11 /* 32 bit value in decimal or hex, with sign */
+
+typedef struct _format_state_t {
+	format_out_t out;
+	void *arg;
+	int cnt;
+	bool stop;
+} format_state_t;
+
+static inline void emit(format_state_t *st, char ch) {
+	if(st->stop) return;
+	if(st->out(ch, st->arg)) {
+		st->stop = true;
+	} else {
+		st->cnt++;
+	}
+}
+
+static void emit_padded(format_state_t *st, const char *str, int len, int width, bool left, char pad) {
+	/* sign goes before zero padding */
+	if(pad == '0' && len && *str == '-') {
+		emit(st, *(str++));
+		len--;
+		width--;
+	}
+
+	int fill = width > len ? width - len : 0;
+	if(!left) while(fill--) emit(st, pad);
+	while(len--) emit(st, *(str++));
+	if(left) while(fill-- > 0) emit(st, ' ');
+}
+
+int format_v(format_out_t out, void *arg, const char *format, va_list ap) {
+	format_state_t st = {.out = out, .arg = arg, .cnt = 0, .stop = false};
+
+	while(*format && !st.stop) {
+		if(*format != '%') {
+			emit(&st, *(format++));
+			continue;
+		}
+		format++;
+
+		/* flags */
+		bool left = false;
+		char pad = ' ';
+		while(*format == '-' || *format == '0') {
+			if(*(format++) == '-') {
+				left = true;
+			} else {
+				pad = '0';
+			}
+		}
+		if(left) pad = ' ';
+
+		/* width */
+		int width = 0;
+		while(IS_DIGIT(*format)) width = width * 10 + DIGIT(*(format++));
+
+		/* length */
+		bool is_long = false;
+		while(*format == 'l') {
+			is_long = true;
+			format++;
+		}
+
+		char buf[NUM_BUF_LEN];
+		char *p = buf + NUM_BUF_LEN;
+		unsigned long val;
+		bool neg = false;
+		unsigned int base = 10;
+		const char *digits = "0123456789abcdef";
+
+		switch(*format) {
+			case 'c':
+				buf[0] = (char)va_arg(ap, int);
+				emit_padded(&st, buf, 1, width, left, ' ');
+				break;
+
+			case 's': {
+				const char *str = va_arg(ap, const char*);
+				if(!str) str = "(null)";
+				int len = 0;
+				while(str[len]) len++;
+				emit_padded(&st, str, len, width, left, ' ');
+				break;
+			}
+
+			case 'd':
+			case 'i': {
+				long sval = is_long ? va_arg(ap, long) : va_arg(ap, int);
+				neg = sval < 0;
+				val = neg ? -(unsigned long)sval : (unsigned long)sval;
+				goto number;
+			}
+
+			case 'X':
+				digits = "0123456789ABCDEF";
+				/* fall through */
+			case 'x':
+				base = 16;
+				/* fall through */
+			case 'u':
+				val = is_long ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+number:
+				do {
+					*(--p) = digits[val % base];
+					val /= base;
+				} while(val);
+				if(neg) *(--p) = '-';
+				emit_padded(&st, p, buf + NUM_BUF_LEN - p, width, left, pad);
+				break;
+
+			case '\0':
+				continue;
+
+			default:
+				/* %% and unknown conversions */
+				emit(&st, *format);
+				break;
+		}
+		format++;
+	}
+
+	return st.cnt;
+}
@@ -0,0 +1,15 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <stdarg.h>
+
+/* character sink, returns non-zero to stop output */
+typedef int (*format_out_t)(char ch, void *arg);
+
+/*
+Integer-only printf subset: %d %i %u %x %X %c %s %%, flags '-' and '0', field width, 'l' modifier.
+Emits characters one by one without intermediate buffer, returns number of characters accepted by sink.
+*/
+int format_v(format_out_t out, void *arg, const char *format, va_list ap);
+
+#endif
@@ -1,6 +1,12 @@
 #include "fp.h"
 
 /* fixed point utilities */
+
+/* series are evaluated with 28 fractional bits */
+#define FP_X_BITS 28
+#define FP_X_ONE ((fixed_d_t)1 << FP_X_BITS)
+#define FP_X_MUL(a, b) (((a) * (b)) >> FP_X_BITS)
+#define FP_X_LN2 ((fixed_d_t)186065280) /* ln(2) * 2^28 */
 #define IS_DIGIT(a) ((a) >= '0' && (a) <= '9')
 #define DIGIT(a) ((a) - '0')
 
@@ -32,3 +38,57 @@ fixed_t str_to_fp(const char *str, const char **endptr) {
 
 	return sign < 0 ? -val : val;
 }
+
+fixed_t fp_ln(fixed_t x) {
+	if(x <= 0) return FP_MIN;
+
+	/* x = m * 2^k, m in [1, 2) */
+	fixed_d_t m = (fixed_d_t)x << (FP_X_BITS - FP_FRACT_BITS);
+	int k = 0;
+	while(m >= 2 * FP_X_ONE) {
+		m >>= 1;
+		k++;
+	}
+	while(m < FP_X_ONE) {
+		m <<= 1;
+		k--;
+	}
+
+	/* ln(m) = 2 * (s + s^3/3 + s^5/5 + s^7/7 + ...), s = (m - 1) / (m + 1) <= 1/3 */
+	fixed_d_t s = ((m - FP_X_ONE) << FP_X_BITS) / (m + FP_X_ONE);
+	fixed_d_t s2 = FP_X_MUL(s, s);
+	fixed_d_t sum = FP_X_ONE / 9;
+	sum = FP_X_ONE / 7 + FP_X_MUL(sum, s2);
+	sum = FP_X_ONE / 5 + FP_X_MUL(sum, s2);
+	sum = FP_X_ONE / 3 + FP_X_MUL(sum, s2);
+	sum = FP_X_ONE + FP_X_MUL(sum, s2);
+	fixed_d_t res = 2 * FP_X_MUL(sum, s) + k * FP_X_LN2;
+
+	/* round to nearest */
+	return (res + ((fixed_d_t)1 << (FP_X_BITS - FP_FRACT_BITS - 1))) >> (FP_X_BITS - FP_FRACT_BITS);
+}
+
+fixed_t fp_exp(fixed_t x) {
+	/* x = k * ln(2) + r, r in [0, ln(2)) */
+	fixed_d_t xx = (fixed_d_t)x << (FP_X_BITS - FP_FRACT_BITS);
+	int k = xx / FP_X_LN2;
+	fixed_d_t r = xx - k * FP_X_LN2;
+	if(r < 0) {
+		r += FP_X_LN2;
+		k--;
+	}
+
+	/* Taylor series up to r^7 / 7!, Horner form */
+	fixed_d_t sum = FP_X_ONE;
+	int n;
+	for(n = 7; n > 0; n--) sum = FP_X_ONE + FP_X_MUL(sum, r) / n;
+
+	/* scale by 2^k, saturate */
+	int shift = FP_X_BITS - FP_FRACT_BITS - k;
+	if(shift <= 0) {
+		if(-shift >= 31 || sum > ((fixed_d_t)FP_MAX >> -shift)) return FP_MAX;
+		return sum << -shift;
+	}
+	if(shift >= 63) return 0;
+	return (sum + ((fixed_d_t)1 << (shift - 1))) >> shift;
+}
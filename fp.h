@@ -36,5 +36,9 @@ typedef int64_t fixed_d_t; /* double sized type for multiplication and division
 #define FP_D_MAX INT64_MAX
 
 fixed_t str_to_fp(const char *str, const char **endptr);
+/* natural logarithm, FP_MIN for non-positive argument */
+fixed_t fp_ln(fixed_t x);
+/* exponent, saturates at FP_MAX */
+fixed_t fp_exp(fixed_t x);
 
 #endif /* _FP_H_ */
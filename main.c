@@ -22,6 +22,12 @@
 #include "dimmer.h"
 #include "pid.h"
 #include "fp.h"
+#include "telemetry.h"
+#include "tseries.h"
+#include "flash.h"
+#include "flashlog.h"
+#include "filter.h"
+#include "psychro.h"
 
 #define DAYTIME_TIMER_PERIOD_MS 1000UL
 
@@ -32,11 +38,36 @@
 
 #define SENSOR_PRIO (tskIDLE_PRIORITY + 2)
 #define SENSOR_STACK_SIZE (configMINIMAL_STACK_SIZE + 512)
+#define TELEM_TIMEOUT_MS (DHT_COLLECTION_PERIOD_MS / 4)
+
+#define TELEM_PRIO (tskIDLE_PRIORITY + 1)
+#define TELEM_STACK_SIZE (configMINIMAL_STACK_SIZE + 128)
+#define TELEM_SERIAL 1
+#define TELEM_BATCH_MAX 8 /* frames per write */
+#define TELEM_BATCH_LEN SERIAL_TX_BUF_LEN /* whole write fits transmit buffer, so it's never split */
+#define TELEM_MIN_INTERVAL_MS 50
+#define TELEM_BAUD_MIN 1200
+#define TELEM_BAUD_MAX 2250000 /* USART2 on 36 MHz APB1, 16x oversampling */
 
 #define SERIAL_BAUDRATE 57600
+#define AUTOBAUD_TIMEOUT_MS 3000UL
+#define BAUD_SWITCH_TIMEOUT_MS 1000UL
 #define LEDS_NUM 2
 #define BLINK_DELAY_MS 10UL
 #define DHT_RESPONSE_LED 0
+#define DHT_CONTROL_SENSOR 0 /* drives fan PID and telemetry */
+
+/* dimmer outputs */
+#define FAN_DIMMER 0 /* intake fan, fan.* settings */
+#define EXHAUST_DIMMER 1
+#define HEATER_DIMMER 2
+#define DHT_FAIL_RUN_BINS 4 /* consecutive failures histogram: 1, 2, 3, 4+ */
+
+/* control sensor history, 8 bytes per bucket */
+#define HIST_FINE_PERIOD_S 60
+#define HIST_FINE_LEN 120 /* 2 h */
+#define HIST_COARSE_PERIOD_S (15 * 60)
+#define HIST_COARSE_LEN 96 /* 24 h */
 
 #ifndef ABS
 #define ABS(x) ((x) < 0 ? -(x) : (x))
@@ -48,6 +79,14 @@ typedef struct _sensor_data_t {
 	unsigned long read_errors;
 	int temperature;
 	int humidity;
+	fixed_t dew_point; /* deg C */
+	fixed_t vpd; /* kPa */
+
+	/* read statistics */
+	unsigned long errors[DHT_ERROR_NUM]; /* per error class */
+	unsigned long fail_runs[DHT_FAIL_RUN_BINS]; /* consecutive failures, counted when the run ends */
+	unsigned int fail_run; /* current run */
+	portTickType last_start; /* last start signal */
 } sensor_data_t;
 
 typedef int (*getter_proc_t)(char *buf, size_t size, int id, volatile void *data);
@@ -69,10 +108,13 @@ static void daytime_cb(xTimerHandle handle);
 static void blink_cb(xTimerHandle handle);
 static void cmd_thread(void *arg);
 static void dht_poll_thread(void *arg);
+static void telem_thread(void *arg);
 static void handle_daytime();
 static void do_blink(int led, portTickType delay);
 
 static int temp_proc(int sern, int argc, char **argv);
+static int hist_proc(int sern, int argc, char **argv);
+static int log_proc(int sern, int argc, char **argv);
 static int saveconf_proc(int sern, int argc, char **argv);
 static int get_proc(int sern, int argc, char **argv);
 static int set_proc(int sern, int argc, char **argv);
@@ -83,11 +125,31 @@ static int gen_fp_get(char *buf, size_t size, int id, volatile void *data);
 static int fan_mode_set(const char *buf, int id, volatile void *data);
 static int fan_mode_get(char *buf, size_t size, int id, volatile void *data);
 static int gen_fp_set(const char *buf, int id, volatile void *data);
+static int gen_uint_get(char *buf, size_t size, int id, volatile void *data);
+static int gen_uint_set(const char *buf, int id, volatile void *data);
 static int fan_upper_limit_set(const char *buf, int id, volatile void *data);
 static int fan_pid_set(const char *buf, int id, volatile void *data);
 
 static int temp_get(char *buf, size_t size, int id, volatile void *data);
 static int hum_get(char *buf, size_t size, int id, volatile void *data);
+static int dht_errors_get(char *buf, size_t size, int id, volatile void *data);
+static int dht_fails_get(char *buf, size_t size, int id, volatile void *data);
+static int on_off_set(const char *buf, int id, volatile void *data);
+static int on_off_get(char *buf, size_t size, int id, volatile void *data);
+static int serial_policy_set(const char *buf, int id, volatile void *data);
+static int serial_policy_get(char *buf, size_t size, int id, volatile void *data);
+static int serial_stats_get(char *buf, size_t size, int id, volatile void *data);
+static int serial_baud_set(const char *buf, int id, volatile void *data);
+static int serial_baud_get(char *buf, size_t size, int id, volatile void *data);
+static int telem_baud_set(const char *buf, int id, volatile void *data);
+static int dimmer_power_set(const char *buf, int id, volatile void *data);
+static int dimmer_power_get(char *buf, size_t size, int id, volatile void *data);
+static int dimmer_mode_set(const char *buf, int id, volatile void *data);
+static int dimmer_mode_get(char *buf, size_t size, int id, volatile void *data);
+static int dimmer_ramp_set(const char *buf, int id, volatile void *data);
+static int mains_freq_get(char *buf, size_t size, int id, volatile void *data);
+static int mains_jitter_get(char *buf, size_t size, int id, volatile void *data);
+static int mains_stat_get(char *buf, size_t size, int id, volatile void *data);
 
 static int light_mode_set(const char *buf, int id, volatile void *data);
 static int light_mode_get(char *buf, size_t size, int id, volatile void *data);
@@ -100,12 +162,17 @@ static int rtc_date_get(char *buf, size_t size, int id, volatile void *data);
 static int rtc_date_set(const char *buf, int id, volatile void *data);
 
 /* static variables */
-static volatile sensor_data_t sensor_data;
+static volatile sensor_data_t sensor_data[DHT_SENSOR_NUM];
+static volatile telem_sample_t telem_snapshot; /* last controller state, protected by sensor_data_mutex */
 static xSemaphoreHandle sensor_data_mutex;
+static ts_ring_t hist_fine; /* protected by sensor_data_mutex */
+static ts_ring_t hist_coarse; /* protected by sensor_data_mutex */
 static xSemaphoreHandle conf_mutex;
 static xTimerHandle blink_timers[LEDS_NUM];
 static pid_state_t fan_pid;
 static volatile light_mode_t light_state = LIGHT_OFF; /* used for choosing temperature */
+static volatile int telem_frames = 0; /* binary frames on command line port */
+static conf_status_t conf_status;
 
 /* configuration variables */
 static const conf_var_t cfgvars[] = {
@@ -129,6 +196,31 @@ static const conf_var_t cfgvars[] = {
 	{.key = "fan.pid.kp", .desc = "Fan PID Kp", .get = gen_fp_get, .set = fan_pid_set, .data = &conf_data.fan_coef.k_p},
 	{.key = "fan.pid.ki", .desc = "Fan PID Ki", .get = gen_fp_get, .set = fan_pid_set, .data = &conf_data.fan_coef.k_i},
 	{.key = "fan.pid.kd", .desc = "Fan PID Kd", .get = gen_fp_get, .set = fan_pid_set, .data = &conf_data.fan_coef.k_d},
+	{.key = "fan.filt.med", .desc = "Fan PID input median window, 1..5 samples",
+		.get = gen_uint_get, .set = gen_uint_set, .data = &conf_data.filter_median},
+	{.key = "fan.filt.alpha", .desc = "Fan PID input smoothing factor, 0..1, 1 - off",
+		.get = gen_fp_get, .set = gen_fp_set, .data = &conf_data.filter_alpha},
+
+	/* other dimmer outputs, percent of RMS power */
+	{.key = "dim.exhaust", .desc = "Exhaust fan power, percent", .get = dimmer_power_get, .set = dimmer_power_set,
+		.id = EXHAUST_DIMMER, .data = &conf_data.dimmer_power[EXHAUST_DIMMER]},
+	{.key = "dim.heater", .desc = "Heater power, percent", .get = dimmer_power_get, .set = dimmer_power_set,
+		.id = HEATER_DIMMER, .data = &conf_data.dimmer_power[HEATER_DIMMER]},
+	{.key = "dim.fan.mode", .desc = "Fan output control Phase/Burst", .get = dimmer_mode_get, .set = dimmer_mode_set,
+		.id = FAN_DIMMER, .data = &conf_data.dimmer_mode[FAN_DIMMER]},
+	{.key = "dim.exhaust.mode", .desc = "Exhaust fan output control Phase/Burst", .get = dimmer_mode_get, .set = dimmer_mode_set,
+		.id = EXHAUST_DIMMER, .data = &conf_data.dimmer_mode[EXHAUST_DIMMER]},
+	{.key = "dim.heater.mode", .desc = "Heater output control Phase/Burst", .get = dimmer_mode_get, .set = dimmer_mode_set,
+		.id = HEATER_DIMMER, .data = &conf_data.dimmer_mode[HEATER_DIMMER]},
+	{.key = "dim.ramp", .desc = "Output power slew rate, percent per mains period, 0 - immediate",
+		.get = gen_fp_get, .set = dimmer_ramp_set, .data = &conf_data.dimmer_ramp},
+
+	/* mains health */
+	{.key = "ac.freq", .desc = "Mains frequency, Hz", .get = mains_freq_get,},
+	{.key = "ac.jitter", .desc = "Mains period deviation histogram, up to 10/25/50/100 us and above",
+		.get = mains_jitter_get,},
+	{.key = "ac.stat", .desc = "Mains state, missed zero crossings, input losses and failsafe activations",
+		.get = mains_stat_get,},
 
 	/* temperature setpoint */
 	{.key = "tsetp.d", .desc = "Temperature setpoint (light switched on)",
@@ -137,8 +229,46 @@ static const conf_var_t cfgvars[] = {
 		.get = gen_fp_get, .set = gen_fp_set, .data = &conf_data.temperature[LIGHT_OFF]},
 
 	/* measured values */
-	{.key = "temp", .desc = "Measured temperature", .get = temp_get,},
-	{.key = "hum", .desc = "Measured humidity", .get = hum_get,},
+	{.key = "temp", .desc = "Measured temperature (canopy)", .get = temp_get, .id = 0,},
+	{.key = "hum", .desc = "Measured humidity (canopy)", .get = hum_get, .id = 0,},
+	{.key = "temp1", .desc = "Measured temperature (root zone)", .get = temp_get, .id = 1,},
+	{.key = "hum1", .desc = "Measured humidity (root zone)", .get = hum_get, .id = 1,},
+	{.key = "dew", .desc = "Dew point (canopy)", .get = gen_fp_get, .data = &sensor_data[0].dew_point,},
+	{.key = "vpd", .desc = "Vapour pressure deficit, kPa (canopy)", .get = gen_fp_get, .data = &sensor_data[0].vpd,},
+	{.key = "dew1", .desc = "Dew point (root zone)", .get = gen_fp_get, .data = &sensor_data[1].dew_point,},
+	{.key = "vpd1", .desc = "Vapour pressure deficit, kPa (root zone)", .get = gen_fp_get, .data = &sensor_data[1].vpd,},
+	{.key = "dht0.err", .desc = "Sensor 0 read errors by class", .get = dht_errors_get, .id = 0,},
+	{.key = "dht1.err", .desc = "Sensor 1 read errors by class", .get = dht_errors_get, .id = 1,},
+	{.key = "dht0.fails", .desc = "Sensor 0 consecutive failures histogram", .get = dht_fails_get, .id = 0,},
+	{.key = "dht1.fails", .desc = "Sensor 1 consecutive failures histogram", .get = dht_fails_get, .id = 1,},
+
+	/* machine readable output */
+	{.key = "telem.frames", .desc = "Binary telemetry frames on console On/Off",
+		.get = on_off_get, .set = on_off_set, .data = &telem_frames},
+	{.key = "telem.port", .desc = "Telemetry stream on serial 1 On/Off, applied after reset",
+		.get = on_off_get, .set = on_off_set, .data = &conf_data.telem_enabled},
+	{.key = "telem.baud", .desc = "Telemetry stream baud rate, 1200..2250000, applied after reset",
+		.get = gen_uint_get, .set = telem_baud_set, .data = &conf_data.telem_baudrate},
+	{.key = "telem.period", .desc = "Telemetry stream transmission period, ms",
+		.get = gen_uint_get, .set = gen_uint_set, .data = &conf_data.telem_period},
+	{.key = "telem.int", .desc = "Telemetry stream sampling interval, ms",
+		.get = gen_uint_get, .set = gen_uint_set, .data = &conf_data.telem_interval},
+
+	/* flash record log */
+	{.key = "log.period", .desc = "Flash log record period, s, 0 - disabled",
+		.get = gen_uint_get, .set = gen_uint_set, .data = &conf_data.log_period},
+
+	/* serial ports */
+	{.key = "ser0.policy", .desc = "Serial 0 full buffer policy Block/Drop/Overwrite",
+		.get = serial_policy_get, .set = serial_policy_set, .id = 0,},
+	{.key = "ser1.policy", .desc = "Serial 1 full buffer policy Block/Drop/Overwrite",
+		.get = serial_policy_get, .set = serial_policy_set, .id = 1,},
+	{.key = "ser0.baud", .desc = "Serial 0 baud rate", .get = serial_baud_get, .set = serial_baud_set, .id = 0,},
+	{.key = "ser1.baud", .desc = "Serial 1 baud rate", .get = serial_baud_get, .set = serial_baud_set, .id = 1,},
+	{.key = "ser0.autobaud", .desc = "Detect serial 0 baud rate from CR sent within 3 s after reset On/Off",
+		.get = on_off_get, .set = on_off_set, .data = &conf_data.serial_autobaud},
+	{.key = "ser0.stats", .desc = "Serial 0 dropped bytes and buffer high-water marks", .get = serial_stats_get, .id = 0,},
+	{.key = "ser1.stats", .desc = "Serial 1 dropped bytes and buffer high-water marks", .get = serial_stats_get, .id = 1,},
 
 	{.key = NULL,},
 };
@@ -150,6 +280,8 @@ static const cmd_handler_t cmdroot[] = {
 
 	/* temperature monitor */
 	{.type = CMD_PROC, .cmd = "temp", .h = {.proc = temp_proc},},
+	{.type = CMD_PROC, .cmd = "hist", .h = {.proc = hist_proc},},
+	{.type = CMD_PROC, .cmd = "log", .h = {.proc = log_proc},},
 
 	{.type = CMD_PROC, .cmd = "saveconf", .h = {.proc = saveconf_proc},},
 	{.type = CMD_PROC, .cmd = "reset", .h = {.proc = reset_proc},},
@@ -216,59 +348,189 @@ static void do_blink(int led, portTickType delay) {
 	}
 }
 
+/* single read with statistics */
+static bool sensor_read(int sensor, xSemaphoreHandle read_sem, sensor_data_t *data) {
+	dht_error_t err = DHT_NO_ERROR;
+
+	/* sensor returns stale data or doesn't respond to start signals closer than that */
+	portTickType since = xTaskGetTickCount() - data->last_start;
+	if(since < DHT_MIN_INTERVAL_MS / portTICK_RATE_MS) vTaskDelay(DHT_MIN_INTERVAL_MS / portTICK_RATE_MS - since);
+	data->last_start = xTaskGetTickCount();
+
+	if(dht_read(sensor, read_sem, &data->temperature, &data->humidity, &err) == 0) {
+		data->timestamp = xTaskGetTickCount();
+		data->dew_point = psy_dew_point(data->temperature, data->humidity);
+		data->vpd = psy_vpd(data->temperature, data->humidity);
+		if(data->fail_run) {
+			data->fail_runs[(data->fail_run < DHT_FAIL_RUN_BINS ? data->fail_run : DHT_FAIL_RUN_BINS) - 1]++;
+			data->fail_run = 0;
+		}
+		return true;
+	}
+
+	data->read_errors++;
+	if(err < DHT_ERROR_NUM) data->errors[err]++;
+	data->fail_run++;
+	return false;
+}
+
 static void dht_poll_thread(void *arg) {
+	int sern = (int)arg;
 	xSemaphoreHandle read_sem;
 	vSemaphoreCreateBinary(read_sem);
 	if(!read_sem) vTaskDelete(NULL);
 
-	sensor_data_t data = {.read_errors = 0};
+	sensor_data_t data[DHT_SENSOR_NUM];
+	sensor_data_t *ctl = &data[DHT_CONTROL_SENSOR];
+	telem_sample_t smp = {.timestamp = 0};
+	uint32_t log_time = 0;
+	filter_t pid_filter;
+	int i;
+
+	filter_reset(&pid_filter);
+
+	memset(data, 0, sizeof(data));
 
 	portTickType last_wake = xTaskGetTickCount();
 	while(1) {
 		vTaskDelayUntil(&last_wake, DHT_COLLECTION_PERIOD_MS / portTICK_RATE_MS);
 
-		dht_error_t err;
-		if(dht_read(read_sem, &data.temperature, &data.humidity, &err) == 0) {
-			data.timestamp = xTaskGetTickCount();
+		/* no retry on failure: the sensor takes a start signal once per collection period */
+		bool ctl_ok = sensor_read(DHT_CONTROL_SENSOR, read_sem, ctl);
+		if(ctl_ok) {
 			do_blink(DHT_RESPONSE_LED, DHT_COLLECTION_PERIOD_MS / portTICK_RATE_MS);
 
+			smp.timestamp = ctl->timestamp;
+			smp.read_errors = ctl->read_errors;
+			smp.temperature = ctl->temperature;
+			smp.humidity = ctl->humidity;
+
 			if(xSemaphoreTake(conf_mutex, DHT_COLLECTION_PERIOD_MS / portTICK_RATE_MS / 2)) {
+				/* reject outliers and smooth quantization steps */
+				smp.pid_input = filter_update(&pid_filter, (ctl->temperature * FP_ONE) / 10,
+						conf_data.filter_median, conf_data.filter_alpha);
+
+				smp.fan_mode = conf_data.fan_mode;
 				if(conf_data.fan_mode == FAN_PID) {
 					/* compute PID */
-					fixed_t input = (data.temperature * FP_ONE) / 10;
-					fixed_t out = pid_compute(&fan_pid,	input, conf_data.temperature[light_state],
-							data.timestamp * portTICK_RATE_MS);
+					fixed_t out = pid_compute(&fan_pid,	smp.pid_input, conf_data.temperature[light_state],
+							ctl->timestamp * portTICK_RATE_MS);
+					smp.pid_setpoint = conf_data.temperature[light_state];
+					smp.pid_output = out;
 
 					fixed_t ll = conf_data.fan_lower_limit;
 					/* Fan torque may be too small at low values, avoid them */
 					if(out > 0 && out < ll)	out = ll;
 
 					/* Adjust fan */
-					dimmer_set(FP_ROUND(out));
+					dimmer_set(FAN_DIMMER, out);
 				}
 				xSemaphoreGive(conf_mutex);
 			}
+
+			if(telem_frames) {
+				smp.dimmer = FP_ROUND(dimmer_get(FAN_DIMMER));
+				smp.light = light_state;
+				telem_send(sern, TELEM_CH_SAMPLE, &smp, sizeof(smp), TELEM_TIMEOUT_MS / portTICK_RATE_MS);
+			}
+
+			/* queued, written by the log thread */
+			uint32_t now = RTC_GetCounter();
+			unsigned int period = conf_data.log_period;
+			if(period && now - log_time >= period) {
+				flog_rec_t rec = {
+					.time = now,
+					.temperature = ctl->temperature,
+					.humidity = ctl->humidity,
+					.dimmer = FP_ROUND(dimmer_get(FAN_DIMMER)),
+					.light = light_state,
+				};
+				if(!flog_append(&rec)) log_time = now;
+			}
 		} else {
-			data.read_errors++;
+			smp.read_errors = ctl->read_errors;
+		}
+
+		/* other sensors are read back-to-back, monitoring only */
+		for(i = 0; i < DHT_SENSOR_NUM; i++) {
+			if(i == DHT_CONTROL_SENSOR) continue;
+
+			sensor_read(i, read_sem, &data[i]);
 		}
 
 		/* update sensor data */
 		if(xSemaphoreTake(sensor_data_mutex, DHT_COLLECTION_PERIOD_MS / portTICK_RATE_MS / 2)) {
-			sensor_data = data;
+			for(i = 0; i < DHT_SENSOR_NUM; i++) sensor_data[i] = data[i];
+			if(ctl_ok && hist_fine.buf) {
+				unsigned long now = ctl->timestamp * portTICK_RATE_MS / 1000;
+				ts_add(&hist_fine, now, ctl->temperature, ctl->humidity);
+				ts_add(&hist_coarse, now, ctl->temperature, ctl->humidity);
+			}
+			telem_snapshot = smp;
 			xSemaphoreGive(sensor_data_mutex);
 		}
 	}
 }
+
+/* periodic snapshots, batched to a single transmission per period */
+static void telem_thread(void *arg) {
+	int sern = (int)arg;
+
+	uint8_t *buf = pvPortMalloc(TELEM_BATCH_LEN);
+	if(!buf) vTaskDelete(NULL);
+
+	unsigned int len = 0;
+	unsigned int cnt = 0;
+
+	portTickType last_wake = xTaskGetTickCount();
+	while(1) {
+		unsigned int interval = conf_data.telem_interval;
+		if(interval < TELEM_MIN_INTERVAL_MS) interval = TELEM_MIN_INTERVAL_MS;
+
+		unsigned int batch = conf_data.telem_period / interval;
+		if(batch < 1) batch = 1;
+		if(batch > TELEM_BATCH_MAX) batch = TELEM_BATCH_MAX;
+
+		vTaskDelayUntil(&last_wake, interval / portTICK_RATE_MS);
+
+		telem_sample_t smp;
+		xSemaphoreTake(sensor_data_mutex, portMAX_DELAY);
+		smp = telem_snapshot;
+		xSemaphoreGive(sensor_data_mutex);
+
+		/* actuators are sampled directly */
+		smp.dimmer = FP_ROUND(dimmer_get(FAN_DIMMER));
+		smp.light = light_state;
+		smp.fan_mode = conf_data.fan_mode;
+
+		len += telem_encode(TELEM_CH_SAMPLE, &smp, sizeof(smp), buf + len);
+		if(++cnt >= batch || len + TELEM_FRAME_MAX_LEN > TELEM_BATCH_LEN) {
+			serial_send_str(sern, (const char*)buf, len, interval / portTICK_RATE_MS);
+			len = cnt = 0;
+		}
+	}
+}
 /*-----------------------------------------------------------------------------*/
-/* show temperature and humidity */
+/* show temperature and humidity, temp [-f] [sensor] */
 static int temp_proc(int sern, int argc, char **argv) {
 	bool follow = (argc > 0) && !strcmp(argv[0], "-f");
+	if(follow) {
+		argc--;
+		argv++;
+	}
+
+	int sensor = argc > 0 ? strtol(argv[0], NULL, 0) : DHT_CONTROL_SENSOR;
+	if(sensor < 0 || sensor >= DHT_SENSOR_NUM) {
+		serial_send_str(sern, "Invalid sensor\r\n", -1, portMAX_DELAY);
+		return 1;
+	}
+
 	do {
 		sensor_data_t data;
 
 		/* get last measurement */
 		xSemaphoreTake(sensor_data_mutex, portMAX_DELAY);
-		data = sensor_data;
+		data = sensor_data[sensor];
 		xSemaphoreGive(sensor_data_mutex);
 
 		serial_iprintf(sern, portMAX_DELAY, "T: %d.%1d degrees C, RH: %d.%1d%%, Timestamp: %lu, Errors count: %lu\r",
@@ -287,6 +549,71 @@ static int temp_proc(int sern, int argc, char **argv) {
 	return 0;
 }
 
+static void print_hist_value(int sern, const ts_value_t *v) {
+	if(v->avg == TS_EMPTY) {
+		serial_send_str(sern, "\t-", -1, portMAX_DELAY);
+		return;
+	}
+
+	int lo = v->avg - v->below;
+	int hi = v->avg + v->above;
+	serial_iprintf(sern, portMAX_DELAY, "\t%d.%1d/%d.%1d/%d.%1d",
+				lo / 10, ABS(lo) % 10, v->avg / 10, ABS(v->avg) % 10, hi / 10, ABS(hi) % 10);
+}
+
+/* dump control sensor history, hist [1|15] resolution in minutes */
+static int hist_proc(int sern, int argc, char **argv) {
+	ts_ring_t *ring = &hist_fine;
+	if(argc > 0 && strtol(argv[0], NULL, 0) == HIST_COARSE_PERIOD_S / 60) ring = &hist_coarse;
+
+	serial_send_str(sern, "Age, min\tT min/avg/max\tRH min/avg/max\r\n", -1, portMAX_DELAY);
+
+	unsigned int age;
+	for(age = 0; ; age++) {
+		ts_bucket_t b;
+		int ret;
+
+		/* short lock per bucket, do not stall the poll thread while printing */
+		xSemaphoreTake(sensor_data_mutex, portMAX_DELAY);
+		ret = ts_get(ring, age, &b);
+		xSemaphoreGive(sensor_data_mutex);
+		if(ret) break;
+
+		serial_iprintf(sern, portMAX_DELAY, "-%u", (age + 1) * ring->period / 60);
+		print_hist_value(sern, &b.temperature);
+		print_hist_value(sern, &b.humidity);
+		serial_send_str(sern, "\r\n", -1, portMAX_DELAY);
+	}
+
+	return 0;
+}
+
+/* export flash log, log [minutes back] */
+static int log_proc(int sern, int argc, char **argv) {
+	uint32_t from = 0;
+	if(argc > 0) {
+		uint32_t back = strtoul(argv[0], NULL, 0) * 60;
+		uint32_t now = RTC_GetCounter();
+		from = back < now ? now - back : 0;
+	}
+
+	flog_iter_t it;
+	flog_rec_t rec;
+	flog_seek(from, &it);
+
+	while(!flog_next(&it, &rec)) {
+		struct tm tim;
+		rtc_to_time(rec.time, &tim);
+		serial_iprintf(sern, portMAX_DELAY, "%02d.%02d.%04d %02d:%02d:%02d\t%d.%1d\t%d.%1d\t%u\t%u\r\n",
+					tim.tm_mday, tim.tm_mon + 1, tim.tm_year + 1900, tim.tm_hour, tim.tm_min, tim.tm_sec,
+					rec.temperature / 10, ABS(rec.temperature) % 10, rec.humidity / 10, rec.humidity % 10,
+					rec.dimmer, rec.light);
+	}
+	serial_iprintf(sern, portMAX_DELAY, "Write errors: %lu\r\n", flog_errors());
+
+	return 0;
+}
+
 static int saveconf_proc(int sern, int argc, char **argv) {
 	if(!conf_write()) {
 		serial_send_str(sern, "Ok\r\n", -1, portMAX_DELAY);
@@ -377,13 +704,29 @@ static int set_proc(int sern, int argc, char **argv) {
 static int gen_fp_get(char *buf, size_t size, int id, volatile void *data) {
 	fixed_t val = *((volatile fixed_t*)data);
 
-	if(sniprintf(buf, size, "%d.%03d",
-				(int)FP_TRUNC(val),
+	if(sniprintf(buf, size, "%s%d.%03d", val < 0 ? "-" : "",
+				(int)FP_TRUNC(FP_ABS(val)),
 				(int)FP_TRUNC(FP_FRAC(FP_ABS(val)) * 1000)) == size) buf[size - 1] = 0;
 
 	return 0;
 }
 
+/* generic unsigned integer getter */
+static int gen_uint_get(char *buf, size_t size, int id, volatile void *data) {
+	if(sniprintf(buf, size, "%u", *((volatile unsigned int*)data)) == size) buf[size - 1] = 0;
+	return 0;
+}
+
+/* generic unsigned integer setter */
+static int gen_uint_set(const char *buf, int id, volatile void *data) {
+	char *end;
+	unsigned long val = strtoul(buf, &end, 0);
+	if(end == buf || *end) return -1;
+
+	*((volatile unsigned int*)data) = val;
+	return 0;
+}
+
 /* generic fixed-point setter */
 static int gen_fp_set(const char *buf, int id, volatile void *data) {
 	*((volatile fixed_t*)data) = str_to_fp(buf, NULL);
@@ -398,7 +741,7 @@ static int fan_mode_set(const char *buf, int id, volatile void *data) {
 		conf_data.fan_mode = mode;
 		if(mode == FAN_MANUAL) {
 			/* Update fan dimmer */
-			dimmer_set(FP_ROUND(conf_data.fan_lower_limit));
+			dimmer_set(FAN_DIMMER, conf_data.fan_lower_limit);
 		}
 		xSemaphoreGive(conf_mutex);
 		return 0;
@@ -442,18 +785,205 @@ static int fan_upper_limit_set(const char *buf, int id, volatile void *data) {
 
 static int temp_get(char *buf, size_t size, int id, volatile void *data) {
 	/* get last measurement */
-	int t = sensor_data.temperature;
+	int t = sensor_data[id].temperature;
 	if(sniprintf(buf, size, "%d.%1d", t / 10, ABS(t) % 10) == size) buf[size - 1] = 0;
 	return 0;
 }
 
 static int hum_get(char *buf, size_t size, int id, volatile void *data) {
 	/* get last measurement */
-	int h = sensor_data.humidity;
+	int h = sensor_data[id].humidity;
 	if(sniprintf(buf, size, "%d.%1d", h / 10, ABS(h) % 10) == size) buf[size - 1] = 0;
 	return 0;
 }
 
+static int dht_errors_get(char *buf, size_t size, int id, volatile void *data) {
+	sensor_data_t d;
+	xSemaphoreTake(sensor_data_mutex, portMAX_DELAY);
+	d = sensor_data[id];
+	xSemaphoreGive(sensor_data_mutex);
+
+	if(sniprintf(buf, size, "irq=%lu to=%lu rcv=%lu dec=%lu crc=%lu",
+				d.errors[DHT_IRQ_TIMEOUT], d.errors[DHT_TIMEOUT], d.errors[DHT_RCV_TIMEOUT],
+				d.errors[DHT_DECODE_ERROR], d.errors[DHT_CHECKSUM_ERROR]) == size)
+		buf[size - 1] = 0;
+
+	return 0;
+}
+
+static int dht_fails_get(char *buf, size_t size, int id, volatile void *data) {
+	sensor_data_t d;
+	xSemaphoreTake(sensor_data_mutex, portMAX_DELAY);
+	d = sensor_data[id];
+	xSemaphoreGive(sensor_data_mutex);
+
+	if(sniprintf(buf, size, "1=%lu 2=%lu 3=%lu 4+=%lu",
+				d.fail_runs[0], d.fail_runs[1], d.fail_runs[2], d.fail_runs[3]) == size)
+		buf[size - 1] = 0;
+
+	return 0;
+}
+
+/* dimmer output set from configuration */
+static int dimmer_power_set(const char *buf, int id, volatile void *data) {
+	fixed_t val = str_to_fp(buf, NULL);
+	if(val < DIMMER_MIN * FP_ONE || val > DIMMER_MAX * FP_ONE) return -1;
+
+	*((volatile fixed_t*)data) = val;
+	dimmer_set(id, val);
+	return 0;
+}
+
+static int dimmer_power_get(char *buf, size_t size, int id, volatile void *data) {
+	fixed_t val = dimmer_get(id);
+	return gen_fp_get(buf, size, id, &val);
+}
+
+/* phase angle or burst (integral cycle) output control */
+static int dimmer_mode_set(const char *buf, int id, volatile void *data) {
+	dimmer_mode_t mode = (!strcmp(buf, "Burst") || !strcmp(buf, "burst") || !strcmp(buf, "1")) ?
+		DIMMER_BURST : DIMMER_PHASE;
+
+	*((volatile dimmer_mode_t*)data) = mode;
+	dimmer_set_mode(id, mode);
+	return 0;
+}
+
+static int dimmer_mode_get(char *buf, size_t size, int id, volatile void *data) {
+	strncpy(buf, dimmer_get_mode(id) == DIMMER_BURST ? "Burst" : "Phase", size);
+	return 0;
+}
+
+static int dimmer_ramp_set(const char *buf, int id, volatile void *data) {
+	fixed_t val = str_to_fp(buf, NULL);
+	if(val < 0 || val > (DIMMER_MAX - DIMMER_MIN) * FP_ONE) return -1;
+
+	*((volatile fixed_t*)data) = val;
+	dimmer_set_ramp(val);
+	return 0;
+}
+
+static int mains_freq_get(char *buf, size_t size, int id, volatile void *data) {
+	mains_stat_t stat;
+	dimmer_get_mains(&stat);
+	return gen_fp_get(buf, size, id, &stat.freq);
+}
+
+static int mains_jitter_get(char *buf, size_t size, int id, volatile void *data) {
+	mains_stat_t stat;
+	dimmer_get_mains(&stat);
+
+	if(sniprintf(buf, size, "%lu %lu %lu %lu %lu",
+				stat.jitter[0], stat.jitter[1], stat.jitter[2], stat.jitter[3], stat.jitter[4]) == size)
+		buf[size - 1] = 0;
+
+	return 0;
+}
+
+static int mains_stat_get(char *buf, size_t size, int id, volatile void *data) {
+	mains_stat_t stat;
+	dimmer_get_mains(&stat);
+
+	if(sniprintf(buf, size, "%s missed=%lu lost=%lu faults=%lu", stat.fault ? "Fault" : "OK",
+				stat.missed, stat.timeouts, stat.faults) == size)
+		buf[size - 1] = 0;
+
+	return 0;
+}
+
+/* generic boolean */
+static int on_off_set(const char *buf, int id, volatile void *data) {
+	if(!strcmp(buf, "On") || !strcmp(buf, "on")) {
+		*((volatile int*)data) = 1;
+	} else if(!strcmp(buf, "Off") || !strcmp(buf, "off")) {
+		*((volatile int*)data) = 0;
+	} else {
+		*((volatile int*)data) = strtol(buf, NULL, 0) != 0;
+	}
+	return 0;
+}
+
+static int on_off_get(char *buf, size_t size, int id, volatile void *data) {
+	strncpy(buf, *((volatile int*)data) ? "On" : "Off", size);
+	return 0;
+}
+
+static int serial_policy_set(const char *buf, int id, volatile void *data) {
+	serial_policy_t policy;
+
+	if(!strcmp(buf, "Block") || !strcmp(buf, "block")) {
+		policy = SERIAL_BLOCK;
+	} else if(!strcmp(buf, "Drop") || !strcmp(buf, "drop")) {
+		policy = SERIAL_DROP_NEWEST;
+	} else if(!strcmp(buf, "Overwrite") || !strcmp(buf, "overwrite")) {
+		policy = SERIAL_OVERWRITE_OLDEST;
+	} else {
+		return -1;
+	}
+
+	conf_data.serial_policy[id] = policy;
+	serial_set_policy(id, policy);
+	return 0;
+}
+
+static int serial_policy_get(char *buf, size_t size, int id, volatile void *data) {
+	const char *str;
+	switch(conf_data.serial_policy[id]) {
+		case SERIAL_DROP_NEWEST:
+			str = "Drop";
+			break;
+
+		case SERIAL_OVERWRITE_OLDEST:
+			str = "Overwrite";
+			break;
+
+		default:
+			str = "Block";
+			break;
+	}
+	strncpy(buf, str, size);
+
+	return 0;
+}
+
+static int serial_baud_set(const char *buf, int id, volatile void *data) {
+	char *end;
+	unsigned long val = strtoul(buf, &end, 0);
+	if(end == buf || *end) return -1;
+
+	return serial_set_baudrate(id, val, BAUD_SWITCH_TIMEOUT_MS / portTICK_RATE_MS);
+}
+
+static int serial_baud_get(char *buf, size_t size, int id, volatile void *data) {
+	if(sniprintf(buf, size, "%u", serial_get_baudrate(id)) == size) buf[size - 1] = 0;
+	return 0;
+}
+
+static inline bool telem_baud_valid(unsigned long baud) {
+	return baud >= TELEM_BAUD_MIN && baud <= TELEM_BAUD_MAX;
+}
+
+/* saved and applied on the next reset, a rate the port can't run at would leave it dead */
+static int telem_baud_set(const char *buf, int id, volatile void *data) {
+	char *end;
+	unsigned long val = strtoul(buf, &end, 0);
+	if(end == buf || *end || !telem_baud_valid(val)) return -1;
+
+	*((volatile unsigned int*)data) = val;
+	return 0;
+}
+
+static int serial_stats_get(char *buf, size_t size, int id, volatile void *data) {
+	serial_stats_t stats;
+	if(serial_get_stats(id, &stats)) return -1;
+
+	if(sniprintf(buf, size, "txdrop=%lu rxdrop=%lu txhwm=%u rxhwm=%u",
+				stats.tx_dropped, stats.rx_dropped, stats.tx_hwm, stats.rx_hwm) == size)
+		buf[size - 1] = 0;
+
+	return 0;
+}
+
 static int light_mode_set(const char *buf, int id, volatile void *data) {
 	light_mode_t mode;
 
@@ -582,6 +1112,13 @@ static void cmd_thread(void *arg) {
 		serial_send_str(sern,
 				"RTC power has been lost. Please set date and time\r\n", -1, portMAX_DELAY);
 	}
+	if(conf_status == CONF_MIGRATED) {
+		serial_send_str(sern,
+				"Configuration converted from older firmware, new settings are defaults. Please check and save\r\n",
+				-1, portMAX_DELAY);
+	} else if(conf_status == CONF_DEFAULTS) {
+		serial_send_str(sern, "No saved configuration, using defaults\r\n", -1, portMAX_DELAY);
+	}
 
 	history.r_idx = history.w_idx = 0;
 	while(1) {
@@ -596,20 +1133,38 @@ static void init_hardware() {
 
 	gpio_init();
     rtc_init();
-    serial_init(CMD_SERIAL, SERIAL_BAUDRATE);
+
+	unsigned int baudrate = 0;
+	if(conf_data.serial_autobaud) baudrate = serial_autobaud(CMD_SERIAL, AUTOBAUD_TIMEOUT_MS);
+	if(!baudrate) baudrate = SERIAL_BAUDRATE;
+
+    serial_init(CMD_SERIAL, baudrate);
 	serial_enabled(CMD_SERIAL, 1); /* enable */
 }
 
 /*-----------------------------------------------------------------------------*/
 int main(void) {
-	init_hardware();
+	int i;
 
 	/* load configuration */
-	conf_init();
+	conf_status = conf_init();
+
+	init_hardware();
+
+	for(i = 0; i < SERIAL_NUM; i++) serial_set_policy(i, conf_data.serial_policy[i]);
 
 	/* init drivers */
 	dht_init();
 	dimmer_init();
+	flash_init();
+	flog_init();
+
+	for(i = 0; i < DIMMER_CHANNELS; i++) dimmer_set_mode(i, conf_data.dimmer_mode[i]);
+	dimmer_set_ramp(conf_data.dimmer_ramp);
+
+	/* outputs not driven by controllers */
+	dimmer_set(EXHAUST_DIMMER, conf_data.dimmer_power[EXHAUST_DIMMER]);
+	dimmer_set(HEATER_DIMMER, conf_data.dimmer_power[HEATER_DIMMER]);
 
 	/* Fan PID */
 	pid_coef_t fan_coef = conf_data.fan_coef;
@@ -620,7 +1175,6 @@ int main(void) {
 									pdTRUE, NULL, daytime_cb);
 	xTimerStart(daytime_timer, portMAX_DELAY);
 
-	int i;
 	for(i = 0; i < LEDS_NUM; i++) {
 		blink_timers[i] = xTimerCreate((const signed char*)"Blink", BLINK_DELAY_MS / portTICK_RATE_MS,
 									pdFALSE, (void*)i, blink_cb);
@@ -631,8 +1185,20 @@ int main(void) {
 
 	/* Sensor polling */
 	sensor_data_mutex = xSemaphoreCreateMutex();
+	ts_bucket_t *hist_buf = pvPortMalloc((HIST_FINE_LEN + HIST_COARSE_LEN) * sizeof(ts_bucket_t));
+	if(hist_buf) {
+		ts_init(&hist_fine, hist_buf, HIST_FINE_LEN, HIST_FINE_PERIOD_S);
+		ts_init(&hist_coarse, hist_buf + HIST_FINE_LEN, HIST_COARSE_LEN, HIST_COARSE_PERIOD_S);
+	}
 	xTaskCreate(dht_poll_thread, (const signed char *)"Poll", SENSOR_STACK_SIZE, (void*)CMD_SERIAL, SENSOR_PRIO, NULL);
 
+	/* Telemetry stream */
+	if(conf_data.telem_enabled && telem_baud_valid(conf_data.telem_baudrate) &&
+			!serial_init(TELEM_SERIAL, conf_data.telem_baudrate)) {
+		serial_enabled(TELEM_SERIAL, 1);
+		xTaskCreate(telem_thread, (const signed char *)"Telem", TELEM_STACK_SIZE, (void*)TELEM_SERIAL, TELEM_PRIO, NULL);
+	}
+
 	/* System configuration */
 	conf_mutex = xSemaphoreCreateMutex();
 
@@ -663,5 +1229,5 @@ void vApplicationStackOverflowHook(xTaskHandle pxTask, signed char *pcTaskName)
 }
 
 void vApplicationMallocFailedHook(void) {
-	serial_send_str(0, "malloc failed!\r\n", -1, portMAX_DELAY);
+	serial_send_str(0, "malloc failed!\r\n", -1, 0); /* never block allocating task */
 }
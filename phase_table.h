@@ -0,0 +1,25 @@
+/* Generated by phase_table.py, do not edit */
+#ifndef _PHASE_TABLE_H_
+#define _PHASE_TABLE_H_
+
+#include <stdint.h>
+
+#define PHASE_TABLE_SIZE 129
+#define PHASE_TABLE_SCALE 65535 /* delay of a whole half-period */
+
+/* firing delay for power k / (PHASE_TABLE_SIZE - 1) */
+static const uint16_t phase_table[PHASE_TABLE_SIZE] = {
+	65535, 58543, 56686, 55366, 54304, 53397, 52597, 51874, 51212, 50597, 50021, 49478,
+	48963, 48471, 48000, 47548, 47112, 46690, 46281, 45884, 45498, 45122, 44754, 44395,
+	44043, 43698, 43360, 43028, 42701, 42379, 42063, 41750, 41442, 41138, 40838, 40541,
+	40248, 39957, 39670, 39385, 39103, 38823, 38545, 38269, 37996, 37724, 37453, 37185,
+	36918, 36652, 36388, 36124, 35862, 35601, 35340, 35081, 34822, 34564, 34306, 34049,
+	33792, 33536, 33280, 33024, 32768, 32511, 32255, 31999, 31743, 31486, 31229, 30971,
+	30713, 30454, 30195, 29934, 29673, 29411, 29147, 28883, 28617, 28350, 28082, 27811,
+	27539, 27266, 26990, 26712, 26432, 26150, 25865, 25578, 25287, 24994, 24697, 24397,
+	24093, 23785, 23472, 23156, 22834, 22507, 22175, 21837, 21492, 21140, 20781, 20413,
+	20037, 19651, 19254, 18845, 18423, 17987, 17535, 17064, 16572, 16057, 15514, 14938,
+	14323, 13661, 12938, 12138, 11231, 10169, 8849, 6992, 0,
+};
+
+#endif /* _PHASE_TABLE_H_ */
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""Generate triac phase table: firing delay for evenly spaced RMS power levels.
+
+Power delivered to a resistive load with firing delay a (fraction of a half-period):
+    P(a) = 1 - a + sin(2 * pi * a) / (2 * pi)
+Entry k is the delay giving P = k / (PHASE_TABLE_SIZE - 1), scaled to 65535.
+"""
+import math
+
+SIZE = 129
+SCALE = 65535
+
+
+def power(a):
+    return 1.0 - a + math.sin(2.0 * math.pi * a) / (2.0 * math.pi)
+
+
+def delay(p):
+    # P(a) is monotonically decreasing, bisect
+    lo, hi = 0.0, 1.0
+    for _ in range(60):
+        mid = (lo + hi) / 2.0
+        if power(mid) > p:
+            lo = mid
+        else:
+            hi = mid
+    return (lo + hi) / 2.0
+
+
+def main():
+    values = [int(round(delay(k / (SIZE - 1.0)) * SCALE)) for k in range(SIZE)]
+
+    print("/* Generated by phase_table.py, do not edit */")
+    print("#ifndef _PHASE_TABLE_H_")
+    print("#define _PHASE_TABLE_H_")
+    print("")
+    print("#include <stdint.h>")
+    print("")
+    print("#define PHASE_TABLE_SIZE %d" % SIZE)
+    print("#define PHASE_TABLE_SCALE %d /* delay of a whole half-period */" % SCALE)
+    print("")
+    print("/* firing delay for power k / (PHASE_TABLE_SIZE - 1) */")
+    print("static const uint16_t phase_table[PHASE_TABLE_SIZE] = {")
+    for i in range(0, SIZE, 12):
+        print("\t" + " ".join("%d," % v for v in values[i:i + 12]))
+    print("};")
+    print("")
+    print("#endif /* _PHASE_TABLE_H_ */")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,39 @@
+/* Dew point and vapour pressure deficit, Magnus formula */
+#include "psychro.h"
+
+#define PSY_A ((fixed_t)18043) /* 17.62 */
+#define PSY_B ((fixed_t)248955) /* 243.12 deg C */
+#define PSY_ES0_X10000 6112 /* saturation pressure at 0 deg C, 0.6112 kPa */
+#define PSY_LN_1000 ((fixed_t)7074) /* ln(1000), humidity scale */
+
+#define HUMIDITY_MIN 1
+#define HUMIDITY_MAX 1000
+
+/* a * t / (b + t) */
+static inline fixed_t magnus(fixed_t t) {
+	return FP_DIV(FP_MUL(PSY_A, t), PSY_B + t);
+}
+
+static inline int clamp_humidity(int humidity) {
+	if(humidity < HUMIDITY_MIN) return HUMIDITY_MIN;
+	if(humidity > HUMIDITY_MAX) return HUMIDITY_MAX;
+	return humidity;
+}
+
+fixed_t psy_dew_point(int temperature, int humidity) {
+	fixed_t t = (temperature * FP_ONE) / 10;
+	humidity = clamp_humidity(humidity);
+
+	/* ln(RH) + a * t / (b + t) */
+	fixed_t g = fp_ln(humidity * FP_ONE) - PSY_LN_1000 + magnus(t);
+
+	return FP_DIV(FP_MUL(PSY_B, g), PSY_A - g);
+}
+
+fixed_t psy_vpd(int temperature, int humidity) {
+	fixed_t t = (temperature * FP_ONE) / 10;
+	humidity = clamp_humidity(humidity);
+
+	fixed_d_t es = (fixed_d_t)fp_exp(magnus(t)) * PSY_ES0_X10000 / 10000;
+	return es * (HUMIDITY_MAX - humidity) / HUMIDITY_MAX;
+}
@@ -0,0 +1,10 @@
+#ifndef _PSYCHRO_H_
+#define _PSYCHRO_H_
+
+#include "fp.h"
+
+/* temperature in 1/10 deg C, humidity in 1/10 % */
+fixed_t psy_dew_point(int temperature, int humidity); /* deg C */
+fixed_t psy_vpd(int temperature, int humidity); /* kPa */
+
+#endif
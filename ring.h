@@ -0,0 +1,109 @@
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stdbool.h>
+#include <string.h>
+
+/*
+Lock-free single producer / single consumer byte ring.
+Indices are free running, head is written by the producer only and tail by the consumer only,
+so an interrupt handler and a task may share the ring without critical sections.
+*/
+typedef struct _ring_t {
+	char *buf;
+	unsigned int mask; /* size - 1, size is a power of two */
+	volatile unsigned int head;
+	volatile unsigned int tail;
+} ring_t;
+
+/* keep buffer accesses on the right side of the index update */
+#define RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+static inline void ring_init(ring_t *r, char *buf, unsigned int size) {
+	r->buf = buf;
+	r->mask = size - 1;
+	r->head = r->tail = 0;
+}
+
+static inline unsigned int ring_used(const ring_t *r) {
+	return r->head - r->tail;
+}
+
+static inline unsigned int ring_free(const ring_t *r) {
+	return r->mask + 1 - (r->head - r->tail);
+}
+
+/* producer side, returns true on empty -> non-empty transition */
+static inline bool ring_put(ring_t *r, char ch) {
+	unsigned int head = r->head;
+	r->buf[head & r->mask] = ch;
+	RING_BARRIER();
+	r->head = head + 1;
+
+	return head == r->tail;
+}
+
+/* consumer side, returns true on full -> non-full transition */
+static inline bool ring_get(ring_t *r, char *ch) {
+	unsigned int tail = r->tail;
+	*ch = r->buf[tail & r->mask];
+	RING_BARRIER();
+	r->tail = tail + 1;
+
+	return r->head - tail == r->mask + 1;
+}
+
+/* producer side, contiguous writable span up to the end of buffer */
+static inline char *ring_write_span(const ring_t *r, unsigned int *len) {
+	unsigned int offs = r->head & r->mask;
+	unsigned int n = r->mask + 1 - (r->head - r->tail);
+	if(n > r->mask + 1 - offs) n = r->mask + 1 - offs;
+
+	*len = n;
+	return &r->buf[offs];
+}
+
+/* producer side, publish n bytes written to the span, returns true on empty -> non-empty transition */
+static inline bool ring_commit(ring_t *r, unsigned int n) {
+	unsigned int head = r->head;
+	RING_BARRIER();
+	r->head = head + n;
+
+	return n && head == r->tail;
+}
+
+/* producer side, copy up to len bytes to the free space without publishing them, returns number of bytes copied */
+static inline unsigned int ring_copy_in(const ring_t *r, const char *data, unsigned int len) {
+	unsigned int offs = r->head & r->mask;
+	unsigned int n = r->mask + 1 - (r->head - r->tail);
+	if(len > n) len = n;
+
+	/* up to the end of buffer, then wrap around */
+	n = r->mask + 1 - offs;
+	if(n > len) n = len;
+	memcpy(&r->buf[offs], data, n);
+	memcpy(r->buf, data + n, len - n);
+
+	return len;
+}
+
+/* consumer side, contiguous readable span up to the end of buffer */
+static inline const char *ring_read_span(const ring_t *r, unsigned int *len) {
+	unsigned int offs = r->tail & r->mask;
+	unsigned int n = r->head - r->tail;
+	if(n > r->mask + 1 - offs) n = r->mask + 1 - offs;
+
+	*len = n;
+	return &r->buf[offs];
+}
+
+/* consumer side, returns true on full -> non-full transition */
+static inline bool ring_consume(ring_t *r, unsigned int n) {
+	unsigned int tail = r->tail;
+	RING_BARRIER();
+	r->tail = tail + n;
+
+	return n && r->head - tail == r->mask + 1;
+}
+
+#endif /* _RING_H_ */
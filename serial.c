@@ -1,16 +1,36 @@
-#include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
 
 #include "FreeRTOS.h"
-#include "queue.h"
+#include "task.h"
 #include "semphr.h"
 
 #include "stm32f10x.h"
 #include "serial.h"
+#include "ring.h"
+#include "format.h"
 
 #define IRQ_PRIO configLIBRARY_KERNEL_INTERRUPT_PRIORITY
-#define QUEUE_LENGTH 256
-#define STR_BUF_LEN 256
+#define DMA_IRQ_PRIO configLIBRARY_KERNEL_INTERRUPT_PRIORITY
+
+#define TX_BUF_LEN SERIAL_TX_BUF_LEN
+#define RX_BUF_LEN 256 /* power of two */
+#define TX_OVERWRITE_CHUNK 16 /* bytes discarded at once by streamed output in overwrite mode */
+
+/*-----------------------------------------------------------------------------*/
+/* Autobaud on USART1 RX (PA10), TIM1_CH3 captures falling edge and CH4 (TI3 indirect) rising edge */
+#define AUTOBAUD_PORT 0
+#define AUTOBAUD_CLK_ENABLE \
+	RCC_APB2PeriphClockCmd((RCC_APB2Periph_GPIOA | RCC_APB2Periph_TIM1), ENABLE)
+#define AUTOBAUD_TIMER TIM1 /* Uses APB2 clock */
+#define AUTOBAUD_GET_PCLK_FREQ(x) (((RCC->CFGR >> 11) & 0x7) >= 4 ? (x)->PCLK2_Frequency * 2 : (x)->PCLK2_Frequency)
+#define AUTOBAUD_START_EDGE_REG CCR3
+#define AUTOBAUD_START_EDGE_FLAG TIM_FLAG_CC3
+#define AUTOBAUD_END_EDGE_REG CCR4
+#define AUTOBAUD_END_EDGE_FLAG TIM_FLAG_CC4
+#define AUTOBAUD_BIT_TIMEOUT_MS 2
+#define AUTOBAUD_TOLERANCE 20 /* 1/x */
 
 typedef struct _usart_t usart_t;
 typedef struct _usart_params_t usart_params_t;
@@ -20,17 +40,48 @@ struct _usart_params_t {
 	GPIO_TypeDef *gpio;
 	unsigned int tx_pin;
 	unsigned int rx_pin;
-	unsigned int clocks;
+	unsigned int clocks; /* APB2 */
+	unsigned int apb1_clocks;
 	unsigned int irq;
+
+	/* DMA transmission, per-byte TXE interrupt is used if NULL */
+	DMA_Channel_TypeDef *tx_dma;
+	unsigned int tx_dma_irq;
+	uint32_t tx_dma_flags;
+
+	/* circular DMA reception, per-byte RXNE interrupt is used if NULL */
+	DMA_Channel_TypeDef *rx_dma;
+	unsigned int rx_dma_irq;
+	uint32_t rx_dma_flags;
+	uint32_t rx_dma_tc_flag; /* end of buffer, counts laps */
 };
 
 struct _usart_t {
 	const usart_params_t* const params;
-	xQueueHandle tx_queue;
-	xQueueHandle rx_queue;
+	int ready;
+
+	unsigned int baudrate;
+	serial_policy_t policy; /* what to do when transmit buffer is full */
+	xSemaphoreHandle tx_lock; /* serializes writer tasks */
+	ring_t tx_ring; /* consumed by TXE or DMA interrupt */
+	volatile unsigned int tx_chunk; /* length of the DMA transfer in progress, 0 if idle */
+	xSemaphoreHandle tx_sem; /* given on full -> non-full transition */
+
+	ring_t rx_ring; /* head is taken from CNDTR and lap count in DMA mode */
+	volatile unsigned int rx_laps; /* DMA buffer wraps */
+	unsigned int rx_held; /* end of the span returned by serial_rcv, released on the next receive call */
+	xSemaphoreHandle rx_sem; /* given on empty -> non-empty transition, line idle or half/full DMA buffer */
+
+	/* statistics */
+	volatile unsigned long tx_dropped;
+	volatile unsigned long rx_dropped;
+	unsigned int tx_hwm;
+	unsigned int rx_hwm;
 };
 
 static void handle_interrupt(int n);
+static void handle_tx_dma_interrupt(int n);
+static void handle_rx_dma_interrupt(int n);
 /*-----------------------------------------------------------------------------*/
 
 static const usart_params_t usart_params[SERIAL_NUM] = {
@@ -42,6 +93,13 @@ static const usart_params_t usart_params[SERIAL_NUM] = {
 		.rx_pin = (1UL << 10),
 		.clocks = RCC_APB2Periph_USART1 | RCC_APB2Periph_GPIOA,
 		.irq = USART1_IRQn,
+		.tx_dma = DMA1_Channel4,
+		.tx_dma_irq = DMA1_Channel4_IRQn,
+		.tx_dma_flags = DMA1_FLAG_GL4,
+		.rx_dma = DMA1_Channel5,
+		.rx_dma_irq = DMA1_Channel5_IRQn,
+		.rx_dma_flags = DMA1_FLAG_GL5,
+		.rx_dma_tc_flag = DMA1_FLAG_TC5,
 	},
 	/* USART1 */
 	{
@@ -49,8 +107,13 @@ static const usart_params_t usart_params[SERIAL_NUM] = {
 		.gpio = GPIOA,
 		.tx_pin = (1UL << 2),
 		.rx_pin = (1UL << 3),
-		.clocks = RCC_APB1Periph_USART2 | RCC_APB2Periph_GPIOA,
+		.clocks = RCC_APB2Periph_GPIOA,
+		.apb1_clocks = RCC_APB1Periph_USART2,
 		.irq = USART2_IRQn,
+		.tx_dma = DMA1_Channel7,
+		.tx_dma_irq = DMA1_Channel7_IRQn,
+		.tx_dma_flags = DMA1_FLAG_GL7,
+		.rx_dma = NULL, /* DMA1 channel 6 is used by DHT sensor capture */
 	},
 };
 
@@ -58,32 +121,353 @@ static usart_t usarts[SERIAL_NUM] = {
 	/* USART0 */
 	{
 		.params = &usart_params[0],
-		.tx_queue = NULL,
-		.rx_queue = NULL,
 	},
 	/* USART1 */
 	{
 		.params = &usart_params[1],
-		.tx_queue = NULL,
-		.rx_queue = NULL,
 	},
 };
 /*-----------------------------------------------------------------------------*/
+static inline usart_t *get_usart(int n) {
+	if(n < 0 || n >= SERIAL_NUM) return NULL;
+	usart_t *usart = &usarts[n];
+	return usart->ready ? usart : NULL;
+}
+
+/* start transfer of the next contiguous chunk, to be called with DMA interrupt masked */
+static void tx_dma_start(usart_t *usart) {
+	DMA_Channel_TypeDef *ch = usart->params->tx_dma;
+
+	unsigned int len;
+	const char *data = ring_read_span(&usart->tx_ring, &len);
+
+	usart->tx_chunk = len;
+	if(!len) return;
+
+	/* DMA writes don't clear transmission complete, serial_set_baudrate waits for it */
+	USART_ClearFlag(usart->params->base, USART_FLAG_TC);
+
+	ch->CCR &= ~DMA_CCR1_EN;
+	ch->CMAR = (uint32_t)data;
+	ch->CNDTR = len;
+	ch->CCR |= DMA_CCR1_EN;
+}
+
+/* writer side functions below are to be called with tx_lock held */
+
+/* discard up to n oldest pending bytes, the DMA transfer in progress is cut short */
+static void tx_drop_oldest(usart_t *usart, unsigned int n) {
+	const usart_params_t *params = usart->params;
+	ring_t *ring = &usart->tx_ring;
+
+	taskENTER_CRITICAL();
+	if(params->tx_dma && usart->tx_chunk) {
+		params->tx_dma->CCR &= ~DMA_CCR1_EN;
+		DMA1->IFCR = params->tx_dma_flags;
+		ring_consume(ring, usart->tx_chunk - params->tx_dma->CNDTR); /* already sent */
+		usart->tx_chunk = 0;
+	}
+
+	unsigned int used = ring_used(ring);
+	if(n > used) n = used;
+	ring_consume(ring, n);
+	usart->tx_dropped += n;
+
+	if(params->tx_dma) tx_dma_start(usart);
+	taskEXIT_CRITICAL();
+}
+
+/* make room according to port policy, returns false if nothing may be written */
+static bool tx_wait(usart_t *usart, unsigned int need, unsigned long timeout) {
+	switch(usart->policy) {
+		case SERIAL_OVERWRITE_OLDEST:
+			tx_drop_oldest(usart, need);
+			return true;
+
+		case SERIAL_DROP_NEWEST:
+			return false;
+
+		default:
+			return xSemaphoreTake(usart->tx_sem, timeout);
+	}
+}
+
+/* reserve contiguous space, make room if buffer is full */
+static char *tx_reserve(usart_t *usart, unsigned int *len, unsigned int need, unsigned long timeout) {
+	while(1) {
+		char *ptr = ring_write_span(&usart->tx_ring, len);
+		if(*len) return ptr;
+
+		if(!tx_wait(usart, need, timeout)) return NULL;
+	}
+}
+
+/* publish reserved bytes and start transmitter if it's idle */
+static void tx_commit(usart_t *usart, unsigned int n) {
+	if(!n) return;
+
+	unsigned int used = ring_used(&usart->tx_ring) + n;
+	if(used > usart->tx_hwm) usart->tx_hwm = used;
+
+	if(usart->params->tx_dma) {
+		ring_commit(&usart->tx_ring, n);
+		if(!usart->tx_chunk) {
+			taskENTER_CRITICAL();
+			if(!usart->tx_chunk) tx_dma_start(usart);
+			taskEXIT_CRITICAL();
+		}
+	} else if(ring_commit(&usart->tx_ring, n)) {
+		/* arm transmitter on empty -> non-empty transition */
+		taskENTER_CRITICAL();
+		USART_ITConfig(usart->params->base, USART_IT_TXE, ENABLE);
+		taskEXIT_CRITICAL();
+	}
+}
+
+static int tx_put(usart_t *usart, char ch, unsigned long timeout) {
+	unsigned int len;
+	char *ptr = tx_reserve(usart, &len, 1, timeout);
+	if(!ptr) {
+		usart->tx_dropped++;
+		return -1;
+	}
+
+	*ptr = ch;
+	tx_commit(usart, 1);
+	return 0;
+}
+
+/* bulk copy, transmitter is armed once per filled portion of buffer */
+static int tx_write(usart_t *usart, const char *data, unsigned int len, unsigned long timeout) {
+	ring_t *ring = &usart->tx_ring;
+	unsigned int cnt = 0;
+
+	if(usart->policy == SERIAL_DROP_NEWEST && len <= ring->mask + 1 && ring_free(ring) < len) {
+		/* don't split lines and frames, drop the whole write */
+		usart->tx_dropped += len;
+		return 0;
+	}
+
+	while(cnt < len) {
+		unsigned int n = ring_copy_in(ring, data + cnt, len - cnt);
+		if(n) {
+			tx_commit(usart, n);
+			cnt += n;
+		} else if(!tx_wait(usart, len - cnt, timeout)) {
+			/* partial write */
+			usart->tx_dropped += len - cnt;
+			break;
+		}
+	}
+
+	return cnt;
+}
+
+/* formatted output goes straight to the reserved ring space */
+typedef struct _tx_stream_t {
+	usart_t *usart;
+	unsigned long timeout;
+	char *ptr; /* reserved span */
+	unsigned int avail; /* left in span */
+	unsigned int used; /* written to span but not committed yet */
+	unsigned int dropped; /* rest of output is counted only once buffer space is refused */
+} tx_stream_t;
+
+static int tx_stream_out(char ch, void *arg) {
+	tx_stream_t *st = (tx_stream_t*)arg;
+
+	if(st->dropped) {
+		st->dropped++;
+		return 0;
+	}
+
+	if(!st->avail) {
+		/* span exhausted, publish it and reserve the next one */
+		tx_commit(st->usart, st->used);
+		st->used = 0;
+		if((st->ptr = tx_reserve(st->usart, &st->avail, TX_OVERWRITE_CHUNK, st->timeout)) == NULL) {
+			st->dropped = 1;
+			return 0;
+		}
+	}
+
+	*(st->ptr++) = ch;
+	st->avail--;
+	st->used++;
+	return 0;
+}
+
+static int tx_dma_init(usart_t *usart) {
+	const usart_params_t *params = usart->params;
+
+	usart->tx_chunk = 0;
+
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+	/* Byte-wide memory to peripheral transfers, address and length are set per chunk */
+	DMA_InitTypeDef dmainit = {
+		.DMA_PeripheralBaseAddr = (uint32_t)&params->base->DR,
+		.DMA_MemoryBaseAddr = (uint32_t)usart->tx_ring.buf,
+		.DMA_DIR = DMA_DIR_PeripheralDST,
+		.DMA_BufferSize = 0,
+		.DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+		.DMA_MemoryInc = DMA_MemoryInc_Enable,
+		.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte,
+		.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte,
+		.DMA_Mode = DMA_Mode_Normal,
+		.DMA_Priority = DMA_Priority_Low,
+		.DMA_M2M = DMA_M2M_Disable,
+	};
+	DMA_DeInit(params->tx_dma);
+	DMA_Init(params->tx_dma, &dmainit);
+	DMA_ITConfig(params->tx_dma, DMA_IT_TC, ENABLE);
+
+	NVIC_InitTypeDef nvinit = {
+		.NVIC_IRQChannel = params->tx_dma_irq,
+		.NVIC_IRQChannelPreemptionPriority = DMA_IRQ_PRIO,
+		.NVIC_IRQChannelSubPriority = 0,
+		.NVIC_IRQChannelCmd = ENABLE,
+	};
+	NVIC_Init(&nvinit);
+
+	USART_DMACmd(params->base, USART_DMAReq_Tx, ENABLE);
+
+	return 0;
+}
+
+/* catch up with the DMA write position, data overwritten before it was read is counted as dropped */
+static inline void rx_dma_sync(usart_t *usart) {
+	const usart_params_t *params = usart->params;
+	ring_t *ring = &usart->rx_ring;
+
+	taskENTER_CRITICAL();
+	unsigned int cnt = params->rx_dma->CNDTR;
+	unsigned int laps = usart->rx_laps;
+	if(DMA1->ISR & params->rx_dma_tc_flag) {
+		/* wrapped, but the interrupt hasn't counted it yet */
+		cnt = params->rx_dma->CNDTR;
+		laps++;
+	}
+	taskEXIT_CRITICAL();
+
+	/* free running index, same origin as tail */
+	unsigned int head = laps * RX_BUF_LEN + ((RX_BUF_LEN - cnt) & ring->mask);
+	unsigned int used = head - ring->tail;
+	if(used > RX_BUF_LEN) {
+		/* lapped by DMA */
+		usart->rx_dropped += used - RX_BUF_LEN;
+		ring->tail = head - RX_BUF_LEN;
+	}
+	ring->head = head;
+}
+
+/* consume the span handed out by serial_rcv, DMA may have lapped it already */
+static inline void rx_release(usart_t *usart) {
+	ring_t *ring = &usart->rx_ring;
+	if((int)(usart->rx_held - ring->tail) > 0) ring_consume(ring, usart->rx_held - ring->tail);
+}
+
+/* wait for received data and return the contiguous span up to the end of buffer */
+static int rx_span(usart_t *usart, const char **data, unsigned long timeout) {
+	unsigned int len;
+
+	while(1) {
+		if(usart->params->rx_dma) rx_dma_sync(usart);
+
+		*data = ring_read_span(&usart->rx_ring, &len);
+		if(len) {
+			unsigned int used = ring_used(&usart->rx_ring);
+			if(used > usart->rx_hwm) usart->rx_hwm = used;
+			return len;
+		}
+
+		if(!xSemaphoreTake(usart->rx_sem, timeout)) return -1;
+	}
+}
+
+static int rx_dma_init(usart_t *usart) {
+	const usart_params_t *params = usart->params;
+
+	usart->rx_laps = 0;
+
+	RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+	/* Byte-wide peripheral to memory transfers, restarted by hardware at the end of buffer */
+	DMA_InitTypeDef dmainit = {
+		.DMA_PeripheralBaseAddr = (uint32_t)&params->base->DR,
+		.DMA_MemoryBaseAddr = (uint32_t)usart->rx_ring.buf,
+		.DMA_DIR = DMA_DIR_PeripheralSRC,
+		.DMA_BufferSize = RX_BUF_LEN,
+		.DMA_PeripheralInc = DMA_PeripheralInc_Disable,
+		.DMA_MemoryInc = DMA_MemoryInc_Enable,
+		.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte,
+		.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte,
+		.DMA_Mode = DMA_Mode_Circular,
+		.DMA_Priority = DMA_Priority_Medium,
+		.DMA_M2M = DMA_M2M_Disable,
+	};
+	DMA_DeInit(params->rx_dma);
+	DMA_Init(params->rx_dma, &dmainit);
+	DMA_ITConfig(params->rx_dma, DMA_IT_HT | DMA_IT_TC, ENABLE);
+
+	NVIC_InitTypeDef nvinit = {
+		.NVIC_IRQChannel = params->rx_dma_irq,
+		.NVIC_IRQChannelPreemptionPriority = DMA_IRQ_PRIO,
+		.NVIC_IRQChannelSubPriority = 0,
+		.NVIC_IRQChannelCmd = ENABLE,
+	};
+	NVIC_Init(&nvinit);
+
+	USART_DMACmd(params->base, USART_DMAReq_Rx, ENABLE);
+	DMA_Cmd(params->rx_dma, ENABLE);
+
+	/* notify reader at the end of each burst */
+	USART_ITConfig(params->base, USART_IT_IDLE, ENABLE);
+
+	return 0;
+}
+
+static void usart_configure(usart_t *usart, unsigned int baudrate) {
+	USART_InitTypeDef usinit = {
+		.USART_BaudRate = baudrate,
+		.USART_WordLength = USART_WordLength_8b,
+		.USART_StopBits = USART_StopBits_1,
+		.USART_Parity = USART_Parity_No,
+		.USART_HardwareFlowControl = USART_HardwareFlowControl_None,
+		.USART_Mode = USART_Mode_Rx | USART_Mode_Tx,
+	};
 
+	/* interrupt and DMA enable bits are preserved */
+	USART_Init(usart->params->base, &usinit);
+	usart->baudrate = baudrate;
+}
+
+/*-----------------------------------------------------------------------------*/
 int serial_init(int n, unsigned int baudrate) {
 	if(n < 0 || n >= SERIAL_NUM) return -1;
 
 	usart_t *usart = &usarts[n];
-	if(usart->tx_queue || usart->rx_queue) return -1;
+	if(usart->ready) return -1;
 
 	const usart_params_t *params = usart->params;
 
-	/* Create the queues used to hold Rx/Tx characters. */
-	if((usart->rx_queue = xQueueCreate(QUEUE_LENGTH, sizeof(char))) == NULL) return -1;
-	if((usart->tx_queue = xQueueCreate(QUEUE_LENGTH + 1, sizeof(char))) == NULL) return -1;
+	/* Allocate the buffers used to hold Rx/Tx characters. */
+	char *buf = pvPortMalloc(TX_BUF_LEN + RX_BUF_LEN);
+	if(buf == NULL) return -1;
+	ring_init(&usart->tx_ring, buf, TX_BUF_LEN);
+	ring_init(&usart->rx_ring, buf + TX_BUF_LEN, RX_BUF_LEN);
+	usart->rx_held = 0;
+
+	usart->tx_lock = xSemaphoreCreateMutex();
+	vSemaphoreCreateBinary(usart->tx_sem);
+	vSemaphoreCreateBinary(usart->rx_sem);
+	if(usart->tx_lock == NULL || usart->tx_sem == NULL || usart->rx_sem == NULL) return -1;
+	xSemaphoreTake(usart->tx_sem, 0);
+	xSemaphoreTake(usart->rx_sem, 0);
 
 	/* Enable USART clock */
 	RCC_APB2PeriphClockCmd(params->clocks, ENABLE);
+	if(params->apb1_clocks) RCC_APB1PeriphClockCmd(params->apb1_clocks, ENABLE);
 
 	/* Configure pins */
 	GPIO_InitTypeDef gpinit;
@@ -97,17 +481,14 @@ int serial_init(int n, unsigned int baudrate) {
 	GPIO_Init(params->gpio, &gpinit);
 
 	/* Configure USART */
-	USART_InitTypeDef usinit = {
-		.USART_BaudRate = baudrate,
-		.USART_WordLength = USART_WordLength_8b,
-		.USART_StopBits = USART_StopBits_1,
-		.USART_Parity = USART_Parity_No,
-		.USART_HardwareFlowControl = USART_HardwareFlowControl_None,
-		.USART_Mode = USART_Mode_Rx | USART_Mode_Tx,
-	};
+	usart_configure(usart, baudrate);
 
-	USART_Init(params->base, &usinit);
-	USART_ITConfig(params->base, USART_IT_RXNE, ENABLE);
+	if(params->rx_dma) {
+		if(rx_dma_init(usart)) return -1;
+	} else {
+		USART_ITConfig(params->base, USART_IT_RXNE, ENABLE);
+	}
+	if(params->tx_dma && tx_dma_init(usart)) return -1;
 
 	/* Configure NVIC */
 	NVIC_InitTypeDef nvinit = {
@@ -118,94 +499,290 @@ int serial_init(int n, unsigned int baudrate) {
 	};
 	NVIC_Init(&nvinit);
 
+	usart->ready = 1;
 	return 0;
 }
 
 void serial_enabled(int n, int enabled) {
-	if(n < 0 || n >= SERIAL_NUM) return;
-	usart_t *usart = &usarts[n];
-	if(!usart->tx_queue || !usart->rx_queue) return;
+	usart_t *usart = get_usart(n);
+	if(!usart) return;
 
 	/* Enable USART */
 	USART_Cmd(usart->params->base, enabled);
 }
 
 int serial_rcv_char(int n, char *ch, unsigned long timeout) {
-	if(n < 0 || n >= SERIAL_NUM) return -1;
-	usart_t *usart = &usarts[n];
-	if(!usart->tx_queue || !usart->rx_queue) return -1;
+	usart_t *usart = get_usart(n);
+	if(!usart) return -1;
+
+	rx_release(usart);
+
+	const char *data;
+	if(rx_span(usart, &data, timeout) < 0) return -1;
+
+	*ch = *data;
+	ring_consume(&usart->rx_ring, 1);
+	return 0;
+}
+
+int serial_rcv(int n, const char **data, unsigned long timeout) {
+	usart_t *usart = get_usart(n);
+	if(!usart) return -1;
 
-	return xQueueReceive(usart->rx_queue, ch, timeout) ? 0 : -1;
+	/* the span stays in the ring until the caller comes back, so the interrupt can't overwrite it */
+	rx_release(usart);
+
+	int len = rx_span(usart, data, timeout);
+	if(len > 0) usart->rx_held = usart->rx_ring.tail + len;
+	return len;
 }
 
 int serial_send_char(int n, int ch, unsigned long timeout) {
-	if(n < 0 || n >= SERIAL_NUM) return -1;
-	usart_t *usart = &usarts[n];
-	if(!usart->tx_queue || !usart->rx_queue) return -1;
+	usart_t *usart = get_usart(n);
+	if(!usart) return -1;
 
-	char out = ch;
-	if(xQueueSend(usart->tx_queue, &out, timeout)) {
-		/* Enable interrupt */
-		USART_ITConfig(usart->params->base, USART_IT_TXE, ENABLE);
-		return 0;
-	}
+	if(!xSemaphoreTake(usart->tx_lock, timeout)) return -1;
+	int ret = tx_put(usart, ch, timeout);
+	xSemaphoreGive(usart->tx_lock);
 
-	return -1;
+	return ret;
 }
 
 int serial_send_str(int n, const char *str, int length, unsigned long timeout) {
-	if(n < 0 || n >= SERIAL_NUM) return -1;
-	usart_t *usart = &usarts[n];
-	if(!usart->tx_queue || !usart->rx_queue) return -1;
+	usart_t *usart = get_usart(n);
+	if(!usart) return -1;
 
-	int cnt = 0;
-	while(length && (length > 0 || *str) && serial_send_char(n, *str, timeout) == 0) {
-		str++;
-		cnt++;
-		if(length > 0) length--;
-	}
+	if(length < 0) length = strlen(str);
+	if(!xSemaphoreTake(usart->tx_lock, timeout)) return 0;
 
+	int cnt = tx_write(usart, str, length, timeout);
+
+	xSemaphoreGive(usart->tx_lock);
 	return cnt;
 }
 
 int serial_iprintf(int n, unsigned long timeout, const char *format, ...) {
-	char buf[STR_BUF_LEN];
+	usart_t *usart = get_usart(n);
+	if(!usart) return -1;
+
+	if(!xSemaphoreTake(usart->tx_lock, timeout)) return 0;
+
+	tx_stream_t st = {.usart = usart, .timeout = timeout, .ptr = NULL, .avail = 0, .used = 0, .dropped = 0};
 	va_list ap;
 
 	va_start(ap, format);
-	int ln = vsniprintf(buf, sizeof(buf), format, ap);
+	int ln = format_v(tx_stream_out, &st, format, ap);
 	va_end(ap);
 
-	return serial_send_str(n, buf, ln, timeout);
+	tx_commit(usart, st.used);
+	usart->tx_dropped += st.dropped;
+
+	xSemaphoreGive(usart->tx_lock);
+	return ln - st.dropped;
+}
+
+int serial_set_baudrate(int n, unsigned int baudrate, unsigned long timeout) {
+	usart_t *usart = get_usart(n);
+	if(!usart || !baudrate) return -1;
+
+	USART_TypeDef *base = usart->params->base;
+
+	/* no new output, let pending one go at the old rate */
+	if(!xSemaphoreTake(usart->tx_lock, timeout)) return -1;
+
+	portTickType start = xTaskGetTickCount();
+	while(ring_used(&usart->tx_ring) || usart->tx_chunk || !USART_GetFlagStatus(base, USART_FLAG_TC)) {
+		if(timeout != portMAX_DELAY && xTaskGetTickCount() - start >= timeout) {
+			xSemaphoreGive(usart->tx_lock);
+			return -1;
+		}
+		vTaskDelay(1);
+	}
+
+	int enabled = (base->CR1 & USART_CR1_UE) != 0;
+	USART_Cmd(base, DISABLE);
+	usart_configure(usart, baudrate);
+	if(enabled) USART_Cmd(base, ENABLE);
+
+	xSemaphoreGive(usart->tx_lock);
+	return 0;
+}
+
+unsigned int serial_get_baudrate(int n) {
+	usart_t *usart = get_usart(n);
+	return usart ? usart->baudrate : 0;
+}
+
+/* width of the first low pulse on RX line, in timer clocks, 0 on timeout */
+static unsigned int autobaud_measure(unsigned long freq, unsigned long timeout_ms) {
+	/* count timer overflows for timeout, scheduler isn't running yet */
+	unsigned long overflows = (freq / 65536 * timeout_ms) / 1000 + 1;
+	unsigned long bit_overflows = (freq / 65536 * AUTOBAUD_BIT_TIMEOUT_MS) / 1000 + 1;
+
+	AUTOBAUD_TIMER->SR = 0;
+	AUTOBAUD_TIMER->CR1 |= TIM_CR1_CEN;
+
+	/* start bit */
+	while(!(AUTOBAUD_TIMER->SR & AUTOBAUD_START_EDGE_FLAG)) {
+		if(AUTOBAUD_TIMER->SR & TIM_FLAG_Update) {
+			AUTOBAUD_TIMER->SR = ~TIM_FLAG_Update;
+			if(!--overflows) return 0;
+		}
+	}
+	uint16_t start = AUTOBAUD_TIMER->AUTOBAUD_START_EDGE_REG;
+	AUTOBAUD_TIMER->SR = ~(AUTOBAUD_END_EDGE_FLAG | TIM_FLAG_Update);
+
+	/* first data bit */
+	while(!(AUTOBAUD_TIMER->SR & AUTOBAUD_END_EDGE_FLAG)) {
+		if(AUTOBAUD_TIMER->SR & TIM_FLAG_Update) {
+			AUTOBAUD_TIMER->SR = ~TIM_FLAG_Update;
+			if(!--bit_overflows) return 0;
+		}
+	}
+	uint16_t end = AUTOBAUD_TIMER->AUTOBAUD_END_EDGE_REG;
+
+	return (uint16_t)(end - start);
+}
+
+unsigned int serial_autobaud(int n, unsigned long timeout_ms) {
+	static const unsigned int rates[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+
+	if(n != AUTOBAUD_PORT || usarts[n].ready) return 0;
+
+	AUTOBAUD_CLK_ENABLE;
+
+	/* RX pin floating input, as configured later by serial_init */
+	GPIO_InitTypeDef gpinit = {
+		.GPIO_Pin = usart_params[n].rx_pin,
+		.GPIO_Mode = GPIO_Mode_IN_FLOATING,
+	};
+	GPIO_Init(usart_params[n].gpio, &gpinit);
+
+	/* Full speed free running timer */
+	RCC_ClocksTypeDef clocks;
+	RCC_GetClocksFreq(&clocks);
+	unsigned long freq = AUTOBAUD_GET_PCLK_FREQ(&clocks);
+
+	TIM_DeInit(AUTOBAUD_TIMER);
+	TIM_PrescalerConfig(AUTOBAUD_TIMER, 0, TIM_PSCReloadMode_Immediate);
+	AUTOBAUD_TIMER->ARR = 0xffff;
+
+	TIM_ICInitTypeDef icconf = {
+		.TIM_Channel = TIM_Channel_3,
+		.TIM_ICPolarity = TIM_ICPolarity_Falling,
+		.TIM_ICSelection = TIM_ICSelection_DirectTI,
+		.TIM_ICPrescaler = TIM_ICPSC_DIV1,
+		.TIM_ICFilter = 0,
+	};
+	TIM_ICInit(AUTOBAUD_TIMER, &icconf);
+
+	icconf.TIM_Channel = TIM_Channel_4;
+	icconf.TIM_ICPolarity = TIM_ICPolarity_Rising;
+	icconf.TIM_ICSelection = TIM_ICSelection_IndirectTI;
+	TIM_ICInit(AUTOBAUD_TIMER, &icconf);
+
+	unsigned int width = autobaud_measure(freq, timeout_ms);
+
+	/* leave timer in reset state for its owner */
+	TIM_DeInit(AUTOBAUD_TIMER);
+	if(!width) return 0;
+
+	/* snap to the nearest standard rate */
+	unsigned int baud = freq / width;
+	unsigned int i;
+	for(i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+		unsigned int diff = baud > rates[i] ? baud - rates[i] : rates[i] - baud;
+		if(diff < rates[i] / AUTOBAUD_TOLERANCE) return rates[i];
+	}
+
+	return 0;
+}
+
+void serial_set_policy(int n, serial_policy_t policy) {
+	if(n < 0 || n >= SERIAL_NUM) return;
+	usarts[n].policy = policy;
+}
+
+int serial_get_stats(int n, serial_stats_t *stats) {
+	usart_t *usart = get_usart(n);
+	if(!usart) return -1;
+
+	stats->tx_dropped = usart->tx_dropped;
+	stats->rx_dropped = usart->rx_dropped;
+	stats->tx_hwm = usart->tx_hwm;
+	stats->rx_hwm = usart->rx_hwm;
+	return 0;
 }
 
 /*-----------------------------------------------------------------------------*/
 static void handle_interrupt(int n) {
 	usart_t *usart = &usarts[n];
-	if(!usart->tx_queue || !usart->rx_queue) return;
+	if(!usart->ready) return;
 
 	const usart_params_t *params = usart->params;
 	portBASE_TYPE preempt = pdFALSE;
 
-	if(USART_GetITStatus(params->base, USART_IT_TXE)) {
+	if(!params->tx_dma && USART_GetITStatus(params->base, USART_IT_TXE)) {
 		/* The interrupt was caused by the THR becoming empty.  Are there any
 		more characters to transmit? */
-		char ch;
-		if(xQueueReceiveFromISR(usart->tx_queue, &ch, &preempt) == pdTRUE) {
+		if(ring_used(&usart->tx_ring)) {
+			char ch;
+			if(ring_get(&usart->tx_ring, &ch)) xSemaphoreGiveFromISR(usart->tx_sem, &preempt);
 			USART_SendData(params->base, ch);
 		} else {
 			USART_ITConfig(params->base, USART_IT_TXE, DISABLE);
 		}
 	}
 
-	if(USART_GetITStatus(params->base, USART_IT_RXNE)) {
+	if(params->rx_dma) {
+		if(USART_GetITStatus(params->base, USART_IT_IDLE)) {
+			USART_ReceiveData(params->base); /* SR read followed by DR read clears IDLE */
+			xSemaphoreGiveFromISR(usart->rx_sem, &preempt);
+		}
+	} else if(USART_GetITStatus(params->base, USART_IT_RXNE)) {
 		char ch = USART_ReceiveData(params->base);
-		xQueueSendFromISR(usart->rx_queue, &ch, &preempt);
+		if(!ring_free(&usart->rx_ring)) {
+			usart->rx_dropped++; /* overflow */
+		} else if(ring_put(&usart->rx_ring, ch)) {
+			xSemaphoreGiveFromISR(usart->rx_sem, &preempt);
+		}
 	}
 
 	portEND_SWITCHING_ISR(preempt);
 }
 
+static void handle_tx_dma_interrupt(int n) {
+	usart_t *usart = &usarts[n];
+	if(!usart->ready) return;
+
+	portBASE_TYPE preempt = pdFALSE;
+
+	DMA1->IFCR = usart->params->tx_dma_flags;
+
+	/* transfer might have been cut short or restarted by writer */
+	if(!usart->tx_chunk || usart->params->tx_dma->CNDTR) return;
+
+	/* release transmitted chunk and continue with the next one */
+	if(ring_consume(&usart->tx_ring, usart->tx_chunk)) xSemaphoreGiveFromISR(usart->tx_sem, &preempt);
+	tx_dma_start(usart);
+
+	portEND_SWITCHING_ISR(preempt);
+}
+
+static void handle_rx_dma_interrupt(int n) {
+	usart_t *usart = &usarts[n];
+	if(!usart->ready) return;
+
+	portBASE_TYPE preempt = pdFALSE;
+
+	/* half or whole buffer filled */
+	if(DMA1->ISR & usart->params->rx_dma_tc_flag) usart->rx_laps++;
+	DMA1->IFCR = usart->params->rx_dma_flags;
+	xSemaphoreGiveFromISR(usart->rx_sem, &preempt);
+
+	portEND_SWITCHING_ISR(preempt);
+}
+
 void USART1_IRQHandler(void) {
 	handle_interrupt(0);
 }
@@ -213,3 +790,15 @@ void USART1_IRQHandler(void) {
 void USART2_IRQHandler(void) {
 	handle_interrupt(1);
 }
+
+void DMAChannel4_IRQHandler(void) {
+	handle_tx_dma_interrupt(0);
+}
+
+void DMAChannel5_IRQHandler(void) {
+	handle_rx_dma_interrupt(0);
+}
+
+void DMAChannel7_IRQHandler(void) {
+	handle_tx_dma_interrupt(1);
+}
@@ -2,13 +2,46 @@
 #define _SERIAL_H_
 
 #define SERIAL_NUM 2
+#define SERIAL_TX_BUF_LEN 256 /* power of two, longer writes may be split */
+
+/* transmit buffer overflow handling */
+typedef enum {
+	SERIAL_BLOCK, /* wait up to timeout */
+	SERIAL_DROP_NEWEST, /* discard data being written, writes shorter than buffer are dropped as a whole */
+	SERIAL_OVERWRITE_OLDEST, /* discard pending data */
+} serial_policy_t;
+
+typedef struct _serial_stats_t {
+	unsigned long tx_dropped;
+	unsigned long rx_dropped;
+	unsigned int tx_hwm; /* high-water marks */
+	unsigned int rx_hwm;
+} serial_stats_t;
 
 int serial_init(int n, unsigned int baudrate);
 void serial_enabled(int n, int enabled);
 int serial_rcv_char(int n, char *ch, unsigned long timeout);
+/*
+Returns length of the received contiguous span. The span is released on the next
+serial_rcv or serial_rcv_char call, until then it takes space in the receive buffer.
+The receive DMA doesn't stop for it, a span lapped by the controller is overwritten.
+*/
+int serial_rcv(int n, const char **data, unsigned long timeout);
 int serial_send_char(int n, int ch, unsigned long timeout);
+/* length < 0 for null-terminated string, returns number of characters queued, less than length on timeout */
 int serial_send_str(int n, const char *str, int length, unsigned long timeout);
 int serial_iprintf(int n, unsigned long timeout, const char *format, ...)
 	__attribute__ ((format (printf, 3, 4)));
+/* waits for pending output to be sent */
+int serial_set_baudrate(int n, unsigned int baudrate, unsigned long timeout);
+unsigned int serial_get_baudrate(int n);
+/*
+To be called before serial_init, console port only.
+Measures start bit of the first received character, which has to have LSB set (e.g. CR).
+Returns nearest standard baud rate or 0.
+*/
+unsigned int serial_autobaud(int n, unsigned long timeout_ms);
+void serial_set_policy(int n, serial_policy_t policy);
+int serial_get_stats(int n, serial_stats_t *stats);
 
 #endif
@@ -0,0 +1,73 @@
+/* Framed binary telemetry */
+#include <stdint.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "serial.h"
+#include "crc.h"
+#include "telemetry.h"
+
+static uint8_t seq = 0; /* shared by all ports and writer tasks */
+
+/* consistent overhead byte stuffing, returns encoded length */
+static unsigned int cobs_encode(const uint8_t *src, unsigned int len, uint8_t *dst) {
+	uint8_t *code_ptr = dst++;
+	uint8_t code = 1;
+	unsigned int cnt = 1;
+
+	while(len--) {
+		if(*src) {
+			*(dst++) = *src;
+			cnt++;
+			code++;
+		}
+		if(!*(src++) || code == 0xff) {
+			*code_ptr = code;
+			code_ptr = dst++;
+			cnt++;
+			code = 1;
+		}
+	}
+	*code_ptr = code;
+
+	return cnt;
+}
+
+int telem_encode(uint8_t channel, const void *payload, unsigned int length, uint8_t *frame) {
+	if(length > TELEM_MAX_PAYLOAD) return -1;
+
+	union {
+		uint32_t words[TELEM_RAW_MAX_LEN / 4];
+		uint8_t bytes[TELEM_RAW_MAX_LEN];
+	} raw;
+
+	/* header and zero padded payload */
+	telem_hdr_t hdr = {.channel = channel, .length = length};
+	taskENTER_CRITICAL();
+	hdr.seq = seq++;
+	taskEXIT_CRITICAL();
+
+	unsigned int words = (sizeof(telem_hdr_t) + length + 3) / 4;
+	raw.words[words - 1] = 0;
+	memcpy(raw.bytes, &hdr, sizeof(telem_hdr_t));
+	memcpy(raw.bytes + sizeof(telem_hdr_t), payload, length);
+
+	raw.words[words] = crc32_calc(raw.words, words);
+
+	frame[0] = 0;
+	unsigned int len = cobs_encode(raw.bytes, (words + 1) * 4, frame + 1) + 1;
+	frame[len++] = 0;
+
+	return len;
+}
+
+int telem_send(int sern, uint8_t channel, const void *payload, unsigned int length, unsigned long timeout) {
+	uint8_t enc[TELEM_FRAME_MAX_LEN];
+	int len = telem_encode(channel, payload, length, enc);
+	if(len < 0) return -1;
+
+	/* whole frame is queued under the port writer lock, so it's never split by text output */
+	return serial_send_str(sern, (const char*)enc, len, timeout) == len ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include <stdint.h>
+#include "fp.h"
+
+/*
+Binary frames share the serial link with the command line.
+Wire format: 0x00, COBS(header, payload, padding, CRC32), 0x00
+Frames never contain zero bytes inside and text never contains them at all,
+so a receiver switches to frame mode on the first zero and back to text on the second.
+CRC32 is computed by the CRC unit over header and zero padded payload.
+*/
+
+/* channels, unframed text belongs to TELEM_CH_CLI */
+#define TELEM_CH_CLI 0
+#define TELEM_CH_SAMPLE 1
+
+#define TELEM_MAX_PAYLOAD 48
+#define TELEM_RAW_MAX_LEN (4 + TELEM_MAX_PAYLOAD + 4) /* header, payload, CRC */
+#define TELEM_FRAME_MAX_LEN (TELEM_RAW_MAX_LEN + TELEM_RAW_MAX_LEN / 254 + 1 + 2) /* COBS overhead and delimiters */
+
+typedef struct _telem_hdr_t {
+	uint8_t channel;
+	uint8_t seq;
+	uint16_t length; /* payload length */
+} telem_hdr_t;
+
+/* periodic controller snapshot, little endian */
+typedef struct _telem_sample_t {
+	uint32_t timestamp; /* ticks */
+	uint32_t read_errors;
+	int16_t temperature; /* 1/10 deg C */
+	int16_t humidity; /* 1/10 % */
+	fixed_t pid_input;
+	fixed_t pid_setpoint;
+	fixed_t pid_output;
+	uint8_t dimmer; /* 0..100 */
+	uint8_t light; /* relay state */
+	uint8_t fan_mode;
+	uint8_t reserved;
+} telem_sample_t;
+
+/* encode frame to buffer of TELEM_FRAME_MAX_LEN bytes, returns encoded length or -1 */
+int telem_encode(uint8_t channel, const void *payload, unsigned int length, uint8_t *frame);
+int telem_send(int sern, uint8_t channel, const void *payload, unsigned int length, unsigned long timeout);
+
+#endif
@@ -0,0 +1,466 @@
+/* Host peripherals and FreeRTOS port for the test build */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "stm32f10x.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "flash.h"
+#include "crc.h"
+#include "test.h"
+#include "mock.h"
+
+#define MOCK_STACK_SIZE (256 * 1024) /* host stack per task, libc needs more than the target */
+#define MOCK_SYSCLK 72000000
+#define MOCK_CUT_STATUS 255 /* exit status of a boot that lost power */
+
+GPIO_TypeDef mock_gpioa, mock_gpiob, mock_gpioc;
+USART_TypeDef mock_usart1 = {.SR = USART_FLAG_TXE | USART_FLAG_TC,};
+USART_TypeDef mock_usart2 = {.SR = USART_FLAG_TXE | USART_FLAG_TC,};
+DMA_TypeDef mock_dma1;
+DMA_Channel_TypeDef mock_dma1_channel[7];
+TIM_TypeDef mock_tim1, mock_tim2, mock_tim3, mock_tim4;
+RCC_TypeDef mock_rcc = {.CFGR = 4 << 8,}; /* APB1 = HCLK / 2, timers x2 */
+
+volatile unsigned long mock_irq_count;
+volatile unsigned long mock_switches;
+
+/*-----------------------------------------------------------------------------*/
+/* port */
+typedef struct _mock_task_t {
+	ucontext_t ctx;
+	pdTASK_CODE code;
+	void *arg;
+} mock_task_t;
+
+/* first TCB member is the top of stack, which holds the host context */
+extern void * volatile pxCurrentTCB;
+#define CURRENT ((mock_task_t*)**(portSTACK_TYPE**)pxCurrentTCB)
+
+static ucontext_t main_ctx;
+static bool running;
+static unsigned int critical_nesting;
+static unsigned int isr_nesting;
+static bool yield_pending;
+static mock_hw_t hw_model;
+
+static void task_entry(void) {
+	mock_task_t *task = CURRENT;
+	task->code(task->arg);
+
+	fprintf(stderr, "mock: task returned\n");
+	abort();
+}
+
+portSTACK_TYPE *pxPortInitialiseStack(portSTACK_TYPE *pxTopOfStack, pdTASK_CODE pxCode, void *pvParameters) {
+	mock_task_t *task = malloc(sizeof(mock_task_t));
+	void *stack = malloc(MOCK_STACK_SIZE);
+	if(!task || !stack) abort();
+
+	getcontext(&task->ctx);
+	task->ctx.uc_stack.ss_sp = stack;
+	task->ctx.uc_stack.ss_size = MOCK_STACK_SIZE;
+	task->ctx.uc_link = NULL;
+	task->code = pxCode;
+	task->arg = pvParameters;
+	makecontext(&task->ctx, task_entry, 0);
+
+	*pxTopOfStack = (portSTACK_TYPE)task;
+	return pxTopOfStack;
+}
+
+static void switch_context(void) {
+	mock_task_t *from = CURRENT;
+	vTaskSwitchContext();
+	mock_task_t *to = CURRENT;
+
+	if(from != to) {
+		mock_switches++;
+		swapcontext(&from->ctx, &to->ctx);
+	}
+}
+
+/* the only yield primitive of the port, deferred while masked as PendSV is */
+void vPortYieldFromISR(void) {
+	if(!running || critical_nesting || isr_nesting) {
+		yield_pending = true;
+		return;
+	}
+	switch_context();
+}
+
+static void yield_if_pending(void) {
+	if(running && yield_pending && !critical_nesting && !isr_nesting) {
+		yield_pending = false;
+		switch_context();
+	}
+}
+
+void vPortEnterCritical(void) {
+	critical_nesting++;
+}
+
+void vPortExitCritical(void) {
+	critical_nesting--;
+	yield_if_pending();
+}
+
+unsigned long ulPortSetInterruptMask(void) {
+	return 0;
+}
+
+void vPortClearInterruptMask(unsigned long ulNewMaskValue) {
+}
+
+portBASE_TYPE xPortStartScheduler(void) {
+	running = true;
+	critical_nesting = 0;
+	yield_pending = false;
+	swapcontext(&main_ctx, &CURRENT->ctx);
+	return 0;
+}
+
+void vPortEndScheduler(void) {
+	running = false;
+	setcontext(&main_ctx);
+}
+
+void vApplicationStackOverflowHook(xTaskHandle pxTask, signed char *pcTaskName) {
+	fprintf(stderr, "mock: stack overflow in %s\n", pcTaskName);
+	abort();
+}
+
+void vApplicationMallocFailedHook(void) {
+	fprintf(stderr, "mock: kernel heap exhausted\n");
+	abort();
+}
+
+/*-----------------------------------------------------------------------------*/
+/* simulated time */
+static void clock_thread(void *arg) {
+	while(1) {
+		if(hw_model) hw_model();
+
+		isr_nesting++;
+		vTaskIncrementTick();
+		isr_nesting--;
+
+		/* preemption by woken tasks, round robin with other idle priority ones */
+		vPortYieldFromISR();
+	}
+}
+
+void mock_run(pdTASK_CODE test, void *arg, unsigned portBASE_TYPE prio) {
+	xTaskCreate(clock_thread, (const signed char *)"Clock", configMINIMAL_STACK_SIZE, NULL, tskIDLE_PRIORITY, NULL);
+	xTaskCreate(test, (const signed char *)"Test", configMINIMAL_STACK_SIZE, arg, prio, NULL);
+	vTaskStartScheduler();
+}
+
+void mock_stop(void) {
+	vTaskEndScheduler();
+}
+
+void mock_set_hw(mock_hw_t hw) {
+	hw_model = hw;
+}
+
+int mock_boot(pdTASK_CODE test, void *arg, unsigned portBASE_TYPE prio) {
+	int status;
+
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid < 0) abort();
+
+	if(!pid) {
+		mock_run(test, arg, prio);
+		fflush(stdout);
+		_exit(test_failures < MOCK_CUT_STATUS ? test_failures : MOCK_CUT_STATUS - 1);
+	}
+
+	if(waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) abort();
+	if(WEXITSTATUS(status) == MOCK_CUT_STATUS) return MOCK_POWER_LOSS;
+	return WEXITSTATUS(status);
+}
+
+void mock_irq(mock_isr_t isr) {
+	static TIM_TypeDef *const tims[] = {&mock_tim1, &mock_tim2, &mock_tim3, &mock_tim4};
+	uint16_t sr[4];
+	unsigned int i;
+
+	for(i = 0; i < 4; i++) sr[i] = tims[i]->SR;
+	mock_dma1.IFCR = 0;
+
+	isr_nesting++;
+	mock_irq_count++;
+	isr();
+	isr_nesting--;
+
+	/* rc_w0: written zeros clear, ones keep */
+	for(i = 0; i < 4; i++) tims[i]->SR &= sr[i];
+
+	/* global flag clears the whole channel */
+	uint32_t clear = mock_dma1.IFCR;
+	for(i = 0; i < 7; i++)
+		if(clear & DMA_FLAG(i + 1, 0x1)) clear |= DMA_FLAG(i + 1, 0xf);
+	mock_dma1.ISR &= ~clear;
+	mock_dma1.IFCR = 0;
+
+	yield_if_pending();
+}
+
+/*-----------------------------------------------------------------------------*/
+/* RCC, NVIC, GPIO */
+void RCC_AHBPeriphClockCmd(uint32_t periph, FunctionalState state) {
+}
+
+void RCC_APB1PeriphClockCmd(uint32_t periph, FunctionalState state) {
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t periph, FunctionalState state) {
+}
+
+void RCC_GetClocksFreq(RCC_ClocksTypeDef *clocks) {
+	clocks->SYSCLK_Frequency = MOCK_SYSCLK;
+	clocks->HCLK_Frequency = MOCK_SYSCLK;
+	clocks->PCLK1_Frequency = MOCK_SYSCLK / 2;
+	clocks->PCLK2_Frequency = MOCK_SYSCLK;
+	clocks->ADCCLK_Frequency = MOCK_SYSCLK / 6;
+}
+
+void NVIC_Init(NVIC_InitTypeDef *init) {
+}
+
+void GPIO_Init(GPIO_TypeDef *gpio, GPIO_InitTypeDef *init) {
+}
+
+void GPIO_PinRemapConfig(uint32_t remap, FunctionalState state) {
+}
+
+/*-----------------------------------------------------------------------------*/
+/* USART */
+void USART_Init(USART_TypeDef *usart, USART_InitTypeDef *init) {
+	usart->BRR = MOCK_SYSCLK / init->USART_BaudRate;
+}
+
+void USART_Cmd(USART_TypeDef *usart, FunctionalState state) {
+	if(state) usart->CR1 |= USART_CR1_UE;
+	else usart->CR1 &= ~USART_CR1_UE;
+}
+
+void USART_ITConfig(USART_TypeDef *usart, uint16_t it, FunctionalState state) {
+	if(state) usart->CR1 |= it;
+	else usart->CR1 &= ~it;
+}
+
+void USART_DMACmd(USART_TypeDef *usart, uint16_t req, FunctionalState state) {
+	if(state) usart->CR3 |= req;
+	else usart->CR3 &= ~req;
+}
+
+ITStatus USART_GetITStatus(USART_TypeDef *usart, uint16_t it) {
+	return (usart->CR1 & usart->SR & it) ? SET : RESET;
+}
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef *usart, uint16_t flag) {
+	return (usart->SR & flag) ? SET : RESET;
+}
+
+void USART_ClearFlag(USART_TypeDef *usart, uint16_t flag) {
+	usart->SR &= ~flag;
+}
+
+void USART_SendData(USART_TypeDef *usart, uint16_t data) {
+	usart->DR = data;
+	usart->SR &= ~(USART_FLAG_TXE | USART_FLAG_TC);
+}
+
+uint16_t USART_ReceiveData(USART_TypeDef *usart) {
+	usart->SR &= ~(USART_FLAG_RXNE | USART_FLAG_IDLE);
+	return usart->DR;
+}
+
+/*-----------------------------------------------------------------------------*/
+/* DMA */
+void DMA_DeInit(DMA_Channel_TypeDef *ch) {
+	memset((void*)ch, 0, sizeof(*ch));
+}
+
+void DMA_Init(DMA_Channel_TypeDef *ch, DMA_InitTypeDef *init) {
+	ch->CCR = init->DMA_DIR | init->DMA_Mode | init->DMA_PeripheralInc | init->DMA_MemoryInc |
+		init->DMA_PeripheralDataSize | init->DMA_MemoryDataSize | init->DMA_Priority | init->DMA_M2M;
+	ch->CNDTR = init->DMA_BufferSize;
+	ch->CPAR = init->DMA_PeripheralBaseAddr;
+	ch->CMAR = init->DMA_MemoryBaseAddr;
+}
+
+void DMA_ITConfig(DMA_Channel_TypeDef *ch, uint32_t it, FunctionalState state) {
+	if(state) ch->CCR |= it;
+	else ch->CCR &= ~it;
+}
+
+void DMA_Cmd(DMA_Channel_TypeDef *ch, FunctionalState state) {
+	if(state) ch->CCR |= DMA_CCR1_EN;
+	else ch->CCR &= ~DMA_CCR1_EN;
+}
+
+/*-----------------------------------------------------------------------------*/
+/* TIM, configuration is kept only where tests look at it */
+void TIM_DeInit(TIM_TypeDef *tim) {
+	memset((void*)tim, 0, sizeof(*tim));
+}
+
+void TIM_PrescalerConfig(TIM_TypeDef *tim, uint16_t prescaler, uint16_t mode) {
+	tim->PSC = prescaler;
+}
+
+void TIM_ICInit(TIM_TypeDef *tim, TIM_ICInitTypeDef *init) {
+}
+
+void TIM_PWMIConfig(TIM_TypeDef *tim, TIM_ICInitTypeDef *init) {
+}
+
+void TIM_SelectInputTrigger(TIM_TypeDef *tim, uint16_t source) {
+}
+
+void TIM_SelectOutputTrigger(TIM_TypeDef *tim, uint16_t source) {
+}
+
+void TIM_SelectSlaveMode(TIM_TypeDef *tim, uint16_t mode) {
+	tim->SMCR = mode;
+}
+
+void TIM_SelectMasterSlaveMode(TIM_TypeDef *tim, uint16_t mode) {
+}
+
+void TIM_SelectOnePulseMode(TIM_TypeDef *tim, uint16_t mode) {
+}
+
+void TIM_UpdateRequestConfig(TIM_TypeDef *tim, uint16_t source) {
+}
+
+void TIM_DMAConfig(TIM_TypeDef *tim, uint16_t base, uint16_t length) {
+	tim->DCR = base | length;
+}
+
+void TIM_OC1Init(TIM_TypeDef *tim, TIM_OCInitTypeDef *init) {
+	tim->CCR1 = init->TIM_Pulse;
+}
+
+void TIM_OC2Init(TIM_TypeDef *tim, TIM_OCInitTypeDef *init) {
+	tim->CCR2 = init->TIM_Pulse;
+}
+
+void TIM_OC3Init(TIM_TypeDef *tim, TIM_OCInitTypeDef *init) {
+	tim->CCR3 = init->TIM_Pulse;
+}
+
+void TIM_OC1PreloadConfig(TIM_TypeDef *tim, uint16_t preload) {
+}
+
+void TIM_OC2PreloadConfig(TIM_TypeDef *tim, uint16_t preload) {
+}
+
+void TIM_OC3PreloadConfig(TIM_TypeDef *tim, uint16_t preload) {
+}
+
+/*-----------------------------------------------------------------------------*/
+/* FLASH, shared mapping so that it survives the boot processes */
+mock_flash_t *mock_flash;
+uint8_t *mock_flash_mem;
+static bool flash_locked = true;
+
+__attribute__((constructor)) static void flash_map(void) {
+	mock_flash = mmap(NULL, sizeof(mock_flash_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(mock_flash == MAP_FAILED) abort();
+	mock_flash_mem = mock_flash->mem;
+	mock_flash_erase_all();
+}
+
+void mock_flash_erase_all(void) {
+	memset(mock_flash->mem, 0xff, MOCK_FLASH_SIZE);
+}
+
+/* counts the operation, returns true if power goes away during it */
+static bool flash_op(void) {
+	return ++mock_flash->ops == mock_flash->cut;
+}
+
+static void power_loss(void) {
+	fflush(stdout);
+	_exit(MOCK_CUT_STATUS);
+}
+
+void FLASH_Unlock(void) {
+	flash_locked = false;
+}
+
+void FLASH_Lock(void) {
+	flash_locked = true;
+}
+
+FLASH_Status FLASH_ErasePage(unsigned long addr) {
+	unsigned long offset = (addr - FLASH_BASE) & ~((unsigned long)FLASH_PAGE_SIZE - 1);
+
+	if(offset >= MOCK_FLASH_SIZE) return FLASH_ERROR_PG;
+	if(flash_locked) {
+		mock_flash->locked_writes++;
+		return FLASH_ERROR_WRP;
+	}
+
+	if(flash_op()) {
+		memset(mock_flash->mem + offset, 0xff, FLASH_PAGE_SIZE / 2);
+		power_loss();
+	}
+	memset(mock_flash->mem + offset, 0xff, FLASH_PAGE_SIZE);
+	return FLASH_COMPLETE;
+}
+
+/* two halfword programs, each needs an erased target unless it writes zero */
+FLASH_Status FLASH_ProgramWord(unsigned long addr, uint32_t data) {
+	unsigned long offset = addr - FLASH_BASE;
+
+	if(offset >= MOCK_FLASH_SIZE || offset & 3) return FLASH_ERROR_PG;
+	if(flash_locked) {
+		mock_flash->locked_writes++;
+		return FLASH_ERROR_WRP;
+	}
+
+	uint16_t *hw = (uint16_t*)(mock_flash->mem + offset);
+	bool cut = flash_op();
+	unsigned int i;
+
+	for(i = 0; i < 2; i++) {
+		uint16_t val = data >> (16 * i);
+		if(hw[i] != 0xffff && val) return FLASH_ERROR_PG;
+		hw[i] = val;
+		if(cut) power_loss();
+	}
+	return FLASH_COMPLETE;
+}
+
+/*-----------------------------------------------------------------------------*/
+/*
+CRC unit: register writes can't be trapped, so the driver call is modelled.
+Polynomial 0x04C11DB7, initial all ones, words MSB first, no reflection.
+*/
+void crc_init() {
+}
+
+uint32_t crc32_calc(const uint32_t *data, unsigned int size) {
+	uint32_t crc = 0xffffffff;
+	unsigned int i;
+
+	while(size--) {
+		crc ^= *(data++);
+		for(i = 0; i < 32; i++) crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+	}
+	return crc;
+}
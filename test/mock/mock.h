@@ -0,0 +1,62 @@
+#ifndef _MOCK_H_
+#define _MOCK_H_
+
+#include <stdint.h>
+#include "stm32f10x.h"
+#include "FreeRTOS.h"
+#include "task.h"
+
+/*
+The kernel is the real one, tasks are host contexts switched by the port in mock.c.
+Simulated time only advances when every task is blocked: a clock task at idle
+priority calls the hardware model and then raises the tick interrupt.
+*/
+
+typedef void (*mock_isr_t)(void);
+typedef void (*mock_hw_t)(void);
+
+/* statistics */
+extern volatile unsigned long mock_irq_count; /* handlers run by mock_irq */
+extern volatile unsigned long mock_switches; /* task context switches */
+
+/*-----------------------------------------------------------------------------*/
+/* run the scheduler with test task at prio, returns after the test task calls mock_stop */
+void mock_run(pdTASK_CODE test, void *arg, unsigned portBASE_TYPE prio);
+void mock_stop(void);
+/* called once per tick from the clock task, before the tick interrupt */
+void mock_set_hw(mock_hw_t hw);
+/*
+Run an interrupt handler. Pending context switch is taken when the outermost
+handler returns, as PendSV does. Timer status flags are write-zero-to-clear
+and DMA flags are cleared by IFCR writes, like on the chip.
+*/
+void mock_irq(mock_isr_t isr);
+
+/*-----------------------------------------------------------------------------*/
+/*
+Run test as a fresh boot: forked process with pristine static state and kernel,
+flash contents and counters are shared. Returns the failure count of the boot,
+or MOCK_POWER_LOSS if power was cut. The caller must not run the scheduler itself.
+*/
+#define MOCK_POWER_LOSS -1
+int mock_boot(pdTASK_CODE test, void *arg, unsigned portBASE_TYPE prio);
+
+/* simulated flash at FLASH_BASE, reads all ones after mock_flash_erase_all */
+#define MOCK_FLASH_SIZE 0x20000
+
+typedef struct _mock_flash_t {
+	uint8_t mem[MOCK_FLASH_SIZE];
+	unsigned long ops; /* program and erase operations */
+	unsigned long locked_writes; /* attempted with the controller locked */
+	/*
+	Power is lost in operation number cut, 0 never. A cut program leaves the
+	second halfword unwritten, a cut erase clears only the first half of the page.
+	*/
+	unsigned long cut;
+} mock_flash_t;
+
+extern mock_flash_t *mock_flash;
+
+void mock_flash_erase_all(void);
+
+#endif /* _MOCK_H_ */
@@ -0,0 +1,383 @@
+/*
+Host stand-in for the StdPeriph headers.
+Peripherals are plain structures in RAM, library calls are stubs in mock.c
+updating them, so drivers run unchanged and tests play the hardware side.
+*/
+#ifndef _MOCK_STM32F10X_H_
+#define _MOCK_STM32F10X_H_
+
+#include <stdint.h>
+
+#define __IO volatile
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+/*-----------------------------------------------------------------------------*/
+/* registers */
+typedef struct {
+	__IO uint32_t CRL;
+	__IO uint32_t CRH;
+	__IO uint32_t IDR;
+	__IO uint32_t ODR;
+	__IO uint32_t BSRR;
+	__IO uint32_t BRR;
+	__IO uint32_t LCKR;
+} GPIO_TypeDef;
+
+typedef struct {
+	__IO uint16_t SR;
+	__IO uint16_t DR;
+	__IO uint16_t BRR;
+	__IO uint16_t CR1;
+	__IO uint16_t CR2;
+	__IO uint16_t CR3;
+	__IO uint16_t GTPR;
+} USART_TypeDef;
+
+typedef struct {
+	__IO uint32_t CCR;
+	__IO uint32_t CNDTR;
+	__IO uint32_t CPAR;
+	__IO uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+	__IO uint32_t ISR;
+	__IO uint32_t IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+	__IO uint16_t CR1;
+	__IO uint16_t CR2;
+	__IO uint16_t SMCR;
+	__IO uint16_t DIER;
+	__IO uint16_t SR;
+	__IO uint16_t EGR;
+	__IO uint16_t CCMR1;
+	__IO uint16_t CCMR2;
+	__IO uint16_t CCER;
+	__IO uint16_t CNT;
+	__IO uint16_t PSC;
+	__IO uint16_t ARR;
+	__IO uint16_t RCR;
+	__IO uint16_t CCR1;
+	__IO uint16_t CCR2;
+	__IO uint16_t CCR3;
+	__IO uint16_t CCR4;
+	__IO uint16_t BDTR;
+	__IO uint16_t DCR;
+	__IO uint16_t DMAR;
+} TIM_TypeDef;
+
+typedef struct {
+	__IO uint32_t CR;
+	__IO uint32_t CFGR;
+} RCC_TypeDef;
+
+extern GPIO_TypeDef mock_gpioa, mock_gpiob, mock_gpioc;
+extern USART_TypeDef mock_usart1, mock_usart2;
+extern DMA_TypeDef mock_dma1;
+extern DMA_Channel_TypeDef mock_dma1_channel[7];
+extern TIM_TypeDef mock_tim1, mock_tim2, mock_tim3, mock_tim4;
+extern RCC_TypeDef mock_rcc;
+
+#define GPIOA (&mock_gpioa)
+#define GPIOB (&mock_gpiob)
+#define GPIOC (&mock_gpioc)
+#define USART1 (&mock_usart1)
+#define USART2 (&mock_usart2)
+#define DMA1 (&mock_dma1)
+#define DMA1_Channel1 (&mock_dma1_channel[0])
+#define DMA1_Channel2 (&mock_dma1_channel[1])
+#define DMA1_Channel3 (&mock_dma1_channel[2])
+#define DMA1_Channel4 (&mock_dma1_channel[3])
+#define DMA1_Channel5 (&mock_dma1_channel[4])
+#define DMA1_Channel6 (&mock_dma1_channel[5])
+#ifdef MOCK_NO_DMA1_CHANNEL7
+#define DMA1_Channel7 NULL /* drivers fall back to interrupt transfers */
+#else
+#define DMA1_Channel7 (&mock_dma1_channel[6])
+#endif
+#define TIM1 (&mock_tim1)
+#define TIM2 (&mock_tim2)
+#define TIM3 (&mock_tim3)
+#define TIM4 (&mock_tim4)
+#define RCC (&mock_rcc)
+
+/* flash array is mapped by mock.c, it outlives boots */
+extern uint8_t *mock_flash_mem;
+#define FLASH_BASE ((unsigned long)mock_flash_mem)
+
+/*-----------------------------------------------------------------------------*/
+/* interrupt numbers */
+typedef enum {
+	DMA1_Channel1_IRQn = 11,
+	DMA1_Channel2_IRQn,
+	DMA1_Channel3_IRQn,
+	DMA1_Channel4_IRQn,
+	DMA1_Channel5_IRQn,
+	DMA1_Channel6_IRQn,
+	DMA1_Channel7_IRQn,
+	TIM1_UP_IRQn = 25,
+	TIM1_CC_IRQn = 27,
+	TIM2_IRQn,
+	TIM3_IRQn,
+	TIM4_IRQn,
+	USART1_IRQn = 37,
+	USART2_IRQn,
+} IRQn_Type;
+
+/*-----------------------------------------------------------------------------*/
+/* RCC */
+typedef struct {
+	uint32_t SYSCLK_Frequency;
+	uint32_t HCLK_Frequency;
+	uint32_t PCLK1_Frequency;
+	uint32_t PCLK2_Frequency;
+	uint32_t ADCCLK_Frequency;
+} RCC_ClocksTypeDef;
+
+#define RCC_AHBPeriph_DMA1 0x0001
+#define RCC_AHBPeriph_CRC 0x0040
+#define RCC_APB2Periph_AFIO 0x0001
+#define RCC_APB2Periph_GPIOA 0x0004
+#define RCC_APB2Periph_GPIOB 0x0008
+#define RCC_APB2Periph_GPIOC 0x0010
+#define RCC_APB2Periph_TIM1 0x0800
+#define RCC_APB2Periph_USART1 0x4000
+#define RCC_APB1Periph_TIM2 0x0001
+#define RCC_APB1Periph_TIM3 0x0002
+#define RCC_APB1Periph_TIM4 0x0004
+#define RCC_APB1Periph_USART2 0x20000
+
+void RCC_AHBPeriphClockCmd(uint32_t periph, FunctionalState state);
+void RCC_APB1PeriphClockCmd(uint32_t periph, FunctionalState state);
+void RCC_APB2PeriphClockCmd(uint32_t periph, FunctionalState state);
+void RCC_GetClocksFreq(RCC_ClocksTypeDef *clocks);
+
+/*-----------------------------------------------------------------------------*/
+/* NVIC */
+typedef struct {
+	uint8_t NVIC_IRQChannel;
+	uint8_t NVIC_IRQChannelPreemptionPriority;
+	uint8_t NVIC_IRQChannelSubPriority;
+	FunctionalState NVIC_IRQChannelCmd;
+} NVIC_InitTypeDef;
+
+void NVIC_Init(NVIC_InitTypeDef *init);
+
+/*-----------------------------------------------------------------------------*/
+/* GPIO */
+typedef enum {GPIO_Speed_10MHz = 1, GPIO_Speed_2MHz, GPIO_Speed_50MHz} GPIOSpeed_TypeDef;
+typedef enum {
+	GPIO_Mode_AIN = 0x0,
+	GPIO_Mode_IN_FLOATING = 0x04,
+	GPIO_Mode_IPD = 0x28,
+	GPIO_Mode_IPU = 0x48,
+	GPIO_Mode_Out_OD = 0x14,
+	GPIO_Mode_Out_PP = 0x10,
+	GPIO_Mode_AF_OD = 0x1C,
+	GPIO_Mode_AF_PP = 0x18,
+} GPIOMode_TypeDef;
+
+typedef struct {
+	uint16_t GPIO_Pin;
+	GPIOSpeed_TypeDef GPIO_Speed;
+	GPIOMode_TypeDef GPIO_Mode;
+} GPIO_InitTypeDef;
+
+#define GPIO_Pin_0 ((uint16_t)0x0001)
+#define GPIO_Pin_1 ((uint16_t)0x0002)
+#define GPIO_Pin_6 ((uint16_t)0x0040)
+#define GPIO_Pin_8 ((uint16_t)0x0100)
+#define GPIO_Pin_10 ((uint16_t)0x0400)
+
+#define GPIO_PartialRemap2_TIM2 ((uint32_t)0x00180200)
+#define GPIO_FullRemap_TIM3 ((uint32_t)0x001A0C00)
+
+void GPIO_Init(GPIO_TypeDef *gpio, GPIO_InitTypeDef *init);
+void GPIO_PinRemapConfig(uint32_t remap, FunctionalState state);
+
+/*-----------------------------------------------------------------------------*/
+/* USART, interrupt enable bits share positions with their status flags */
+#define USART_FLAG_IDLE ((uint16_t)0x0010)
+#define USART_FLAG_RXNE ((uint16_t)0x0020)
+#define USART_FLAG_TC ((uint16_t)0x0040)
+#define USART_FLAG_TXE ((uint16_t)0x0080)
+#define USART_IT_IDLE USART_FLAG_IDLE
+#define USART_IT_RXNE USART_FLAG_RXNE
+#define USART_IT_TC USART_FLAG_TC
+#define USART_IT_TXE USART_FLAG_TXE
+#define USART_CR1_UE ((uint16_t)0x2000)
+#define USART_DMAReq_Tx ((uint16_t)0x0080)
+#define USART_DMAReq_Rx ((uint16_t)0x0040)
+
+#define USART_WordLength_8b ((uint16_t)0x0000)
+#define USART_StopBits_1 ((uint16_t)0x0000)
+#define USART_Parity_No ((uint16_t)0x0000)
+#define USART_Mode_Rx ((uint16_t)0x0004)
+#define USART_Mode_Tx ((uint16_t)0x0008)
+#define USART_HardwareFlowControl_None ((uint16_t)0x0000)
+
+typedef struct {
+	uint32_t USART_BaudRate;
+	uint16_t USART_WordLength;
+	uint16_t USART_StopBits;
+	uint16_t USART_Parity;
+	uint16_t USART_Mode;
+	uint16_t USART_HardwareFlowControl;
+} USART_InitTypeDef;
+
+void USART_Init(USART_TypeDef *usart, USART_InitTypeDef *init);
+void USART_Cmd(USART_TypeDef *usart, FunctionalState state);
+void USART_ITConfig(USART_TypeDef *usart, uint16_t it, FunctionalState state);
+void USART_DMACmd(USART_TypeDef *usart, uint16_t req, FunctionalState state);
+ITStatus USART_GetITStatus(USART_TypeDef *usart, uint16_t it);
+FlagStatus USART_GetFlagStatus(USART_TypeDef *usart, uint16_t flag);
+void USART_ClearFlag(USART_TypeDef *usart, uint16_t flag);
+void USART_SendData(USART_TypeDef *usart, uint16_t data);
+uint16_t USART_ReceiveData(USART_TypeDef *usart);
+
+/*-----------------------------------------------------------------------------*/
+/* DMA, channel n flags are shifted by 4 * (n - 1) */
+#define DMA_CCR1_EN ((uint16_t)0x0001)
+#define DMA_IT_TC ((uint32_t)0x00000002)
+#define DMA_IT_HT ((uint32_t)0x00000004)
+#define DMA_FLAG(n, f) ((uint32_t)(f) << (4 * ((n) - 1)))
+#define DMA1_FLAG_GL4 DMA_FLAG(4, 0x1)
+#define DMA1_FLAG_GL5 DMA_FLAG(5, 0x1)
+#define DMA1_FLAG_GL6 DMA_FLAG(6, 0x1)
+#define DMA1_FLAG_GL7 DMA_FLAG(7, 0x1)
+#define DMA1_FLAG_TC4 DMA_FLAG(4, 0x2)
+#define DMA1_FLAG_TC5 DMA_FLAG(5, 0x2)
+#define DMA1_FLAG_TC6 DMA_FLAG(6, 0x2)
+#define DMA1_FLAG_TC7 DMA_FLAG(7, 0x2)
+#define DMA1_FLAG_HT5 DMA_FLAG(5, 0x4)
+
+#define DMA_DIR_PeripheralDST ((uint32_t)0x00000010)
+#define DMA_DIR_PeripheralSRC ((uint32_t)0x00000000)
+#define DMA_PeripheralInc_Disable ((uint32_t)0x00000000)
+#define DMA_MemoryInc_Enable ((uint32_t)0x00000080)
+#define DMA_PeripheralDataSize_Byte ((uint32_t)0x00000000)
+#define DMA_PeripheralDataSize_HalfWord ((uint32_t)0x00000100)
+#define DMA_MemoryDataSize_Byte ((uint32_t)0x00000000)
+#define DMA_MemoryDataSize_HalfWord ((uint32_t)0x00000400)
+#define DMA_Mode_Normal ((uint32_t)0x00000000)
+#define DMA_Mode_Circular ((uint32_t)0x00000020)
+#define DMA_Priority_Low ((uint32_t)0x00000000)
+#define DMA_Priority_Medium ((uint32_t)0x00001000)
+#define DMA_Priority_High ((uint32_t)0x00002000)
+#define DMA_M2M_Disable ((uint32_t)0x00000000)
+
+typedef struct {
+	uint32_t DMA_PeripheralBaseAddr;
+	uint32_t DMA_MemoryBaseAddr;
+	uint32_t DMA_DIR;
+	uint32_t DMA_BufferSize;
+	uint32_t DMA_PeripheralInc;
+	uint32_t DMA_MemoryInc;
+	uint32_t DMA_PeripheralDataSize;
+	uint32_t DMA_MemoryDataSize;
+	uint32_t DMA_Mode;
+	uint32_t DMA_Priority;
+	uint32_t DMA_M2M;
+} DMA_InitTypeDef;
+
+void DMA_DeInit(DMA_Channel_TypeDef *ch);
+void DMA_Init(DMA_Channel_TypeDef *ch, DMA_InitTypeDef *init);
+void DMA_ITConfig(DMA_Channel_TypeDef *ch, uint32_t it, FunctionalState state);
+void DMA_Cmd(DMA_Channel_TypeDef *ch, FunctionalState state);
+
+/*-----------------------------------------------------------------------------*/
+/* TIM */
+#define TIM_CR1_CEN ((uint16_t)0x0001)
+#define TIM_FLAG_Update ((uint16_t)0x0001)
+#define TIM_FLAG_CC1 ((uint16_t)0x0002)
+#define TIM_FLAG_CC2 ((uint16_t)0x0004)
+#define TIM_FLAG_CC3 ((uint16_t)0x0008)
+#define TIM_FLAG_CC4 ((uint16_t)0x0010)
+#define TIM_IT_Update TIM_FLAG_Update
+#define TIM_IT_CC1 TIM_FLAG_CC1
+#define TIM_DMA_CC1 ((uint16_t)0x0200)
+
+#define TIM_Channel_1 ((uint16_t)0x0000)
+#define TIM_Channel_2 ((uint16_t)0x0004)
+#define TIM_Channel_3 ((uint16_t)0x0008)
+#define TIM_Channel_4 ((uint16_t)0x000C)
+#define TIM_ICPolarity_Rising ((uint16_t)0x0000)
+#define TIM_ICPolarity_Falling ((uint16_t)0x0002)
+#define TIM_ICSelection_DirectTI ((uint16_t)0x0001)
+#define TIM_ICSelection_IndirectTI ((uint16_t)0x0002)
+#define TIM_ICPSC_DIV1 ((uint16_t)0x0000)
+#define TIM_PSCReloadMode_Immediate ((uint16_t)0x0001)
+#define TIM_TS_ITR0 ((uint16_t)0x0000)
+#define TIM_TS_ITR3 ((uint16_t)0x0030)
+#define TIM_TS_TI1FP1 ((uint16_t)0x0050)
+#define TIM_TRGOSource_Reset ((uint16_t)0x0000)
+#define TIM_TRGOSource_Update ((uint16_t)0x0020)
+#define TIM_SlaveMode_Reset ((uint16_t)0x0004)
+#define TIM_SlaveMode_Trigger ((uint16_t)0x0006)
+#define TIM_MasterSlaveMode_Enable ((uint16_t)0x0080)
+#define TIM_OPMode_Single ((uint16_t)0x0008)
+#define TIM_UpdateSource_Regular ((uint16_t)0x0001)
+#define TIM_DMABase_CCR1 ((uint16_t)0x000D)
+#define TIM_DMABurstLength_2Transfers ((uint16_t)0x0100)
+#define TIM_OCMode_PWM2 ((uint16_t)0x0070)
+#define TIM_OutputState_Enable ((uint16_t)0x0001)
+#define TIM_OCPolarity_High ((uint16_t)0x0000)
+#define TIM_OCPreload_Enable ((uint16_t)0x0008)
+
+typedef struct {
+	uint16_t TIM_Channel;
+	uint16_t TIM_ICPolarity;
+	uint16_t TIM_ICSelection;
+	uint16_t TIM_ICPrescaler;
+	uint16_t TIM_ICFilter;
+} TIM_ICInitTypeDef;
+
+typedef struct {
+	uint16_t TIM_OCMode;
+	uint16_t TIM_OutputState;
+	uint16_t TIM_OutputNState;
+	uint16_t TIM_Pulse;
+	uint16_t TIM_OCPolarity;
+	uint16_t TIM_OCNPolarity;
+	uint16_t TIM_OCIdleState;
+	uint16_t TIM_OCNIdleState;
+} TIM_OCInitTypeDef;
+
+void TIM_DeInit(TIM_TypeDef *tim);
+void TIM_PrescalerConfig(TIM_TypeDef *tim, uint16_t prescaler, uint16_t mode);
+void TIM_ICInit(TIM_TypeDef *tim, TIM_ICInitTypeDef *init);
+void TIM_PWMIConfig(TIM_TypeDef *tim, TIM_ICInitTypeDef *init);
+void TIM_SelectInputTrigger(TIM_TypeDef *tim, uint16_t source);
+void TIM_SelectOutputTrigger(TIM_TypeDef *tim, uint16_t source);
+void TIM_SelectSlaveMode(TIM_TypeDef *tim, uint16_t mode);
+void TIM_SelectMasterSlaveMode(TIM_TypeDef *tim, uint16_t mode);
+void TIM_SelectOnePulseMode(TIM_TypeDef *tim, uint16_t mode);
+void TIM_UpdateRequestConfig(TIM_TypeDef *tim, uint16_t source);
+void TIM_DMAConfig(TIM_TypeDef *tim, uint16_t base, uint16_t length);
+void TIM_OC1Init(TIM_TypeDef *tim, TIM_OCInitTypeDef *init);
+void TIM_OC2Init(TIM_TypeDef *tim, TIM_OCInitTypeDef *init);
+void TIM_OC3Init(TIM_TypeDef *tim, TIM_OCInitTypeDef *init);
+void TIM_OC1PreloadConfig(TIM_TypeDef *tim, uint16_t preload);
+void TIM_OC2PreloadConfig(TIM_TypeDef *tim, uint16_t preload);
+void TIM_OC3PreloadConfig(TIM_TypeDef *tim, uint16_t preload);
+
+/*-----------------------------------------------------------------------------*/
+/* FLASH, programming checks the target halfwords are erased */
+typedef enum {
+	FLASH_BUSY = 1,
+	FLASH_ERROR_PG,
+	FLASH_ERROR_WRP,
+	FLASH_COMPLETE,
+	FLASH_TIMEOUT
+} FLASH_Status;
+
+void FLASH_Unlock(void);
+void FLASH_Lock(void);
+FLASH_Status FLASH_ErasePage(unsigned long addr);
+FLASH_Status FLASH_ProgramWord(unsigned long addr, uint32_t data);
+
+#endif /* _MOCK_STM32F10X_H_ */
@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "test.h"
+
+int test_failures;
+
+double test_time() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int test_report(const char *name) {
+	printf("%s: %s (%d failed)\n", name, test_failures ? "FAIL" : "ok", test_failures);
+	return test_failures ? 1 : 0;
+}
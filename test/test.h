@@ -0,0 +1,31 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+#include <stdio.h>
+
+extern int test_failures;
+
+#define CHECK(cond) \
+do { \
+	if(!(cond)) { \
+		test_failures++; \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+	} \
+} while(0)
+
+#define CHECK_EQ(a, b) \
+do { \
+	long _a = (long)(a), _b = (long)(b); \
+	if(_a != _b) { \
+		test_failures++; \
+		printf("%s:%d: check failed: %s == %s (%ld != %ld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+	} \
+} while(0)
+
+/*-----------------------------------------------------------------------------*/
+/* host monotonic time, seconds */
+double test_time();
+/* print the summary line, returns process exit status */
+int test_report(const char *name);
+
+#endif /* _TEST_H_ */
@@ -0,0 +1,322 @@
+/*
+DHT22 reads through the driver: the model plays TIM3 and its DMA channel,
+moving (period, low) captures into the edge buffer as the timer would,
+then raises DMA completion or timer overflow for short frames.
+Besides the fixed traces, frames are synthesized with timing jitter, line
+glitches and per sensor timing variants, success rate is reported per jitter.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mock.h"
+#include "test.h"
+#include "semphr.h"
+#include "am2302.h"
+#include "dht_decode.h"
+
+#define DHT_EDGES (2 + DHT_PKT_SIZE * 8)
+#define MAX_GLITCHES 4
+#define JITTER_MAX_US 24
+#define JITTER_STEP_US 2
+#define SWEEP_FRAMES 200
+
+void TIM3_IRQHandler(void);
+void DMAChannel6_IRQHandler(void);
+
+typedef struct _pwm_capture_t {
+	uint16_t period;
+	uint16_t low;
+} pwm_capture_t;
+
+/*
+Edge captures of whole reads in the edge buffer layout, bit timings spread
+as AM2302 sensors show them: low 48..56 us, high 22..30 us for 0 and 68..75 us for 1.
+The first edge follows the start signal release and isn't measured.
+*/
+static const pwm_capture_t trace_23_5c_45_2rh[] = {
+	{24, 22}, {163, 78}, {73, 50}, {76, 53}, {77, 51}, {75, 48}, {80, 50}, {76, 54},
+	{74, 48}, {126, 52}, {121, 51}, {117, 49}, {80, 53}, {76, 52}, {80, 54}, {126, 56},
+	{78, 52}, {78, 50}, {75, 48}, {78, 56}, {80, 54}, {82, 56}, {84, 56}, {78, 54},
+	{79, 52}, {76, 54}, {126, 52}, {130, 56}, {118, 49}, {82, 55}, {123, 49}, {76, 54},
+	{122, 51}, {122, 54}, {124, 49}, {75, 51}, {122, 48}, {123, 53}, {80, 53}, {80, 51},
+	{71, 48}, {80, 56},
+};
+static const pwm_capture_t trace_minus_10_1c_99_9rh[] = {
+	{40, 21}, {162, 83}, {73, 48}, {77, 54}, {79, 50}, {71, 48}, {85, 55}, {76, 50},
+	{130, 55}, {122, 49}, {121, 49}, {117, 49}, {123, 50}, {76, 49}, {73, 49}, {126, 54},
+	{118, 50}, {120, 49}, {122, 53}, {81, 51}, {81, 52}, {73, 49}, {74, 48}, {78, 49},
+	{79, 51}, {76, 53}, {80, 56}, {119, 48}, {122, 54}, {76, 51}, {83, 55}, {122, 48},
+	{81, 55}, {122, 51}, {121, 49}, {119, 49}, {77, 50}, {70, 48}, {125, 55}, {120, 52},
+	{123, 55}, {120, 52},
+};
+
+/*-----------------------------------------------------------------------------*/
+/* sensor and capture hardware */
+typedef struct _dht_frame_t {
+	const pwm_capture_t *edges;
+	unsigned int len;
+	bool silent; /* no capture interrupt at all */
+} dht_frame_t;
+
+static volatile dht_frame_t frame;
+
+static void hw_tick(void) {
+	DMA_Channel_TypeDef *ch = DMA1_Channel6;
+
+	if(!(TIM3->CR1 & TIM_CR1_CEN) || !(ch->CCR & DMA_CCR1_EN)) return;
+	if(frame.silent) return;
+
+	/* one CCR1, CCR2 burst per falling edge */
+	uint16_t *mem = (uint16_t*)(uintptr_t)ch->CMAR;
+	unsigned int i;
+	for(i = 0; i < frame.len && ch->CNDTR; i++) {
+		unsigned int pos = DHT_EDGES * 2 - ch->CNDTR;
+		mem[pos] = frame.edges[i].period;
+		mem[pos + 1] = frame.edges[i].low;
+		ch->CNDTR -= 2;
+	}
+
+	if(!ch->CNDTR) {
+		DMA1->ISR |= DMA1_FLAG_TC6 | DMA1_FLAG_GL6;
+		mock_irq(DMAChannel6_IRQHandler);
+	} else {
+		/* line quiet for a bit time */
+		TIM3->SR = TIM_FLAG_Update;
+		mock_irq(TIM3_IRQHandler);
+	}
+}
+
+/*-----------------------------------------------------------------------------*/
+static xSemaphoreHandle read_sem;
+
+static dht_error_t read_frame(const pwm_capture_t *edges, unsigned int len, int *t, int *h) {
+	dht_error_t error = DHT_NO_ERROR;
+
+	frame.edges = edges;
+	frame.len = len;
+	frame.silent = false;
+	if(dht_read(0, read_sem, t, h, &error)) return error;
+	return DHT_NO_ERROR;
+}
+
+static void test_recorded() {
+	pwm_capture_t edges[DHT_EDGES];
+	int t, h;
+
+	CHECK_EQ(read_frame(trace_23_5c_45_2rh, DHT_EDGES, &t, &h), DHT_NO_ERROR);
+	CHECK_EQ(t, 235);
+	CHECK_EQ(h, 452);
+
+	CHECK_EQ(read_frame(trace_minus_10_1c_99_9rh, DHT_EDGES, &t, &h), DHT_NO_ERROR);
+	CHECK_EQ(t, -101);
+	CHECK_EQ(h, 999);
+
+	/* cut short, the capture timer overflow ends it */
+	CHECK_EQ(read_frame(trace_23_5c_45_2rh, DHT_EDGES - 10, &t, &h), DHT_TIMEOUT);
+	CHECK_EQ(read_frame(trace_23_5c_45_2rh, 0, &t, &h), DHT_TIMEOUT);
+
+	/* data bit out of both windows */
+	memcpy(edges, trace_23_5c_45_2rh, sizeof(edges));
+	edges[20].period = edges[20].low + 110;
+	CHECK_EQ(read_frame(edges, DHT_EDGES, &t, &h), DHT_DECODE_ERROR);
+
+	/* bit flipped between windows, caught by the checksum */
+	memcpy(edges, trace_23_5c_45_2rh, sizeof(edges));
+	edges[2 + 20].period = edges[2 + 20].low + (edges[2 + 20].period - edges[2 + 20].low > 50 ? 26 : 70);
+	CHECK_EQ(read_frame(edges, DHT_EDGES, &t, &h), DHT_CHECKSUM_ERROR);
+
+	/* no capture interrupt */
+	frame.silent = true;
+	dht_error_t error;
+	CHECK(dht_read(0, read_sem, &t, &h, &error) < 0);
+	CHECK_EQ(error, DHT_IRQ_TIMEOUT);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* synthesized frames */
+typedef struct _dht_timing_t {
+	const char *name;
+	unsigned int response_low, response_high;
+	unsigned int bit_low, bit_0_high, bit_1_high;
+} dht_timing_t;
+
+static const dht_timing_t variants[] = {
+	{"nominal", DHT_RESPONSE_LOW_US, DHT_RESPONSE_HIGH_US, DHT_BIT_LOW_US, DHT_BIT_0_HIGH_US, DHT_BIT_1_HIGH_US},
+	{"am2302", 78, 82, 52, 26, 72},
+	{"slow", 84, 86, 56, 30, 76},
+	{"fast", 76, 76, 48, 22, 68},
+	{"short-0", 80, 80, 50, 20, 70},
+	{"long-low", 80, 80, 64, 27, 70},
+};
+#define VARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+/* distance of a level to the nearer end of [lo, hi) */
+static unsigned int margin(unsigned int us, unsigned int lo, unsigned int hi) {
+	unsigned int below = us - lo, above = hi - 1 - us;
+	return below < above ? below : above;
+}
+
+/* window of a nominal level as margin() arguments */
+#define WIN(n) (n) - (n) / DHT_TOLERANCE_DIV, (n) + (n) / DHT_TOLERANCE_DIV
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* largest jitter keeping every level inside its window, a 1 must also stay above the 0 window */
+static unsigned int safe_jitter(const dht_timing_t *tm) {
+	unsigned int j = margin(tm->response_low, WIN(DHT_RESPONSE_LOW_US));
+	j = MIN(j, margin(tm->response_high, WIN(DHT_RESPONSE_HIGH_US)));
+	j = MIN(j, margin(tm->bit_low, WIN(DHT_BIT_LOW_US)));
+	j = MIN(j, margin(tm->bit_0_high, WIN(DHT_BIT_0_HIGH_US)));
+	j = MIN(j, margin(tm->bit_1_high, DHT_BIT_0_HIGH_US + DHT_BIT_0_HIGH_US / DHT_TOLERANCE_DIV,
+		DHT_BIT_1_HIGH_US + DHT_BIT_1_HIGH_US / DHT_TOLERANCE_DIV));
+	return j;
+}
+
+static unsigned int jitter(unsigned int us, unsigned int j) {
+	int v = (int)us + (j ? rand() % (2 * j + 1) - (int)j : 0);
+	return v < 1 ? 1 : v;
+}
+
+static void make_pkt(int t, int h, uint8_t *pkt) {
+	unsigned int val = t < 0 ? (-t | 0x8000) : t;
+
+	pkt[0] = h >> 8;
+	pkt[1] = h;
+	pkt[2] = val >> 8;
+	pkt[3] = val;
+	pkt[4] = pkt[0] + pkt[1] + pkt[2] + pkt[3];
+}
+
+static void put_edge(pwm_capture_t *edge, unsigned int low, unsigned int high) {
+	edge->period = low + high;
+	edge->low = low;
+}
+
+/*
+Returns edge count, glitches are short low pulses splitting a data bit high.
+Not placed in the last bit, the edge after it would be past the DMA buffer.
+*/
+static unsigned int synth_frame(const dht_timing_t *tm, const uint8_t *pkt, unsigned int j, unsigned int glitches,
+		pwm_capture_t *edges) {
+	unsigned int n = 0, bit;
+
+	put_edge(&edges[n++], 10 + rand() % 20, 20 + rand() % 20);
+	put_edge(&edges[n++], jitter(tm->response_low, j), jitter(tm->response_high, j));
+
+	for(bit = 0; bit < DHT_PKT_SIZE * 8; bit++) {
+		unsigned int low = jitter(tm->bit_low, j);
+		unsigned int high = jitter(pkt[bit / 8] & (0x80 >> (bit % 8)) ? tm->bit_1_high : tm->bit_0_high, j);
+
+		if(glitches && bit < DHT_PKT_SIZE * 8 - 1 && rand() % (DHT_PKT_SIZE * 8 - 1 - bit) < glitches) {
+			unsigned int at = 1 + rand() % high, width = 1 + rand() % 2;
+			put_edge(&edges[n++], low, at);
+			put_edge(&edges[n++], width, high > at + width ? high - at - width : 1);
+			glitches--;
+		} else {
+			put_edge(&edges[n++], low, high);
+		}
+	}
+
+	return n;
+}
+
+/* random readings through the driver, counts correct and wrongly accepted ones */
+static void run_frames(const dht_timing_t *tm, unsigned int j, unsigned int glitches, unsigned int frames,
+		unsigned int *good, unsigned int *wrong, unsigned int errors[DHT_ERROR_NUM]) {
+	pwm_capture_t edges[DHT_EDGES + MAX_GLITCHES];
+	uint8_t pkt[DHT_PKT_SIZE];
+	unsigned int k;
+
+	*good = *wrong = 0;
+	for(k = 0; k < frames; k++) {
+		int t = rand() % 1200 - 400, h = rand() % 1001;
+		int rt, rh;
+
+		make_pkt(t, h, pkt);
+		unsigned int len = synth_frame(tm, pkt, j, glitches, edges);
+		dht_error_t error = read_frame(edges, len, &rt, &rh);
+
+		errors[error]++;
+		if(error == DHT_NO_ERROR) {
+			if(rt == t && rh == h) (*good)++;
+			else (*wrong)++;
+		}
+	}
+}
+
+static void test_synthesized() {
+	unsigned int errors[DHT_ERROR_NUM] = {0};
+	unsigned int good, wrong, total_wrong = 0, frames = 0;
+	unsigned int v, j, g;
+
+	srand(1);
+	double start = test_time();
+
+	/* success rate per jitter for each timing variant, all good within its margins */
+	printf("jitter us");
+	for(v = 0; v < VARIANTS; v++) printf(" %9s", variants[v].name);
+	printf("\n%9s", "margin");
+	for(v = 0; v < VARIANTS; v++) printf(" %9u", safe_jitter(&variants[v]));
+	printf("\n");
+
+	for(j = 0; j <= JITTER_MAX_US; j += JITTER_STEP_US) {
+		printf("%9u", j);
+		for(v = 0; v < VARIANTS; v++) {
+			run_frames(&variants[v], j, 0, SWEEP_FRAMES, &good, &wrong, errors);
+			printf(" %8.1f%%", 100.0 * good / SWEEP_FRAMES);
+			frames += SWEEP_FRAMES;
+			total_wrong += wrong;
+
+			if(j <= safe_jitter(&variants[v])) CHECK_EQ(good, SWEEP_FRAMES);
+		}
+		printf("\n");
+	}
+	printf("errors: decode %u, checksum %u, wrongly accepted %u\n",
+		errors[DHT_DECODE_ERROR], errors[DHT_CHECKSUM_ERROR], total_wrong);
+
+	/* any glitch inside a frame rejects it */
+	for(g = 1; g <= MAX_GLITCHES; g++) {
+		memset(errors, 0, sizeof(errors));
+		run_frames(&variants[0], 0, g, SWEEP_FRAMES, &good, &wrong, errors);
+		CHECK_EQ(good + wrong, 0);
+		CHECK_EQ(errors[DHT_DECODE_ERROR], SWEEP_FRAMES);
+		frames += SWEEP_FRAMES;
+	}
+
+	/* frame cut at every edge ends with the capture timer overflow */
+	pwm_capture_t edges[DHT_EDGES];
+	uint8_t pkt[DHT_PKT_SIZE];
+	unsigned int len;
+	int t, h;
+
+	make_pkt(-123, 456, pkt);
+	synth_frame(&variants[0], pkt, 0, 0, edges);
+	for(len = 0; len < DHT_EDGES; len++) {
+		CHECK_EQ(read_frame(edges, len, &t, &h), DHT_TIMEOUT);
+		frames++;
+	}
+	CHECK_EQ(read_frame(edges, DHT_EDGES, &t, &h), DHT_NO_ERROR);
+	CHECK_EQ(t, -123);
+	CHECK_EQ(h, 456);
+
+	double elapsed = test_time() - start;
+	printf("%u frames through the driver, %.0f frames/s\n", frames, frames / elapsed);
+	CHECK(frames / elapsed > 1000);
+}
+
+static void test_thread(void *arg) {
+	vSemaphoreCreateBinary(read_sem);
+	CHECK_EQ(dht_init(), 0);
+	mock_set_hw(hw_tick);
+
+	test_recorded();
+	test_synthesized();
+
+	mock_stop();
+}
+
+int main() {
+	mock_run(test_thread, NULL, tskIDLE_PRIORITY + 1);
+	return test_report("dht");
+}
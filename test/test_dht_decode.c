@@ -0,0 +1,151 @@
+/*
+DHT22 bit decoder state machine, fed one capture at a time as the
+interrupt handler would: window edges, overlap resolution, terminal states.
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "dht_decode.h"
+
+#define DHT_EDGES (2 + DHT_PKT_SIZE * 8)
+
+/* accepted range [lo, hi) around nominal */
+#define WIN_LO(n) ((n) - (n) / DHT_TOLERANCE_DIV)
+#define WIN_HI(n) ((n) + (n) / DHT_TOLERANCE_DIV)
+
+static dht_dec_state_t feed(dht_decoder_t *dec, unsigned int low, unsigned int high) {
+	return dht_decoder_feed(dec, low + high, low);
+}
+
+/* start edge and response */
+static void start(dht_decoder_t *dec) {
+	dht_decoder_reset(dec);
+	CHECK_EQ(feed(dec, 10, 20), DHT_DEC_BUSY);
+	CHECK_EQ(feed(dec, DHT_RESPONSE_LOW_US, DHT_RESPONSE_HIGH_US), DHT_DEC_BUSY);
+}
+
+static dht_dec_state_t feed_bit(dht_decoder_t *dec, int bit) {
+	return feed(dec, DHT_BIT_LOW_US, bit ? DHT_BIT_1_HIGH_US : DHT_BIT_0_HIGH_US);
+}
+
+static void test_reset() {
+	dht_decoder_t dec;
+
+	memset(&dec, 0xa5, sizeof(dec));
+	dht_decoder_reset(&dec);
+	CHECK_EQ(dec.state, DHT_DEC_BUSY);
+	CHECK_EQ(dec.edge, 0);
+	unsigned int i;
+	for(i = 0; i < DHT_PKT_SIZE; i++) CHECK_EQ(dec.data[i], 0);
+}
+
+/* every byte value at every position, done exactly on the last edge */
+static void test_bytes() {
+	dht_decoder_t dec;
+	unsigned int pos, val, bit;
+
+	for(pos = 0; pos < DHT_PKT_SIZE; pos++) {
+		for(val = 0; val < 256; val++) {
+			uint8_t pkt[DHT_PKT_SIZE] = {0x5a, 0x5a, 0x5a, 0x5a, 0x5a};
+			pkt[pos] = val;
+
+			start(&dec);
+			for(bit = 0; bit < DHT_PKT_SIZE * 8; bit++) {
+				dht_dec_state_t state = feed_bit(&dec, pkt[bit / 8] & (0x80 >> (bit % 8)));
+				CHECK_EQ(state, bit == DHT_PKT_SIZE * 8 - 1 ? DHT_DEC_DONE : DHT_DEC_BUSY);
+			}
+			CHECK(!memcmp(dec.data, pkt, DHT_PKT_SIZE));
+			CHECK_EQ(dec.edge, DHT_EDGES);
+		}
+	}
+}
+
+static void test_response_window() {
+	dht_decoder_t dec;
+
+	const unsigned int lo = WIN_LO(DHT_RESPONSE_LOW_US), hi = WIN_HI(DHT_RESPONSE_LOW_US);
+	const unsigned int hlo = WIN_LO(DHT_RESPONSE_HIGH_US), hhi = WIN_HI(DHT_RESPONSE_HIGH_US);
+	const struct {unsigned int low, high; dht_dec_state_t state;} cases[] = {
+		{lo, DHT_RESPONSE_HIGH_US, DHT_DEC_BUSY},
+		{lo - 1, DHT_RESPONSE_HIGH_US, DHT_DEC_ERROR},
+		{hi - 1, DHT_RESPONSE_HIGH_US, DHT_DEC_BUSY},
+		{hi, DHT_RESPONSE_HIGH_US, DHT_DEC_ERROR},
+		{DHT_RESPONSE_LOW_US, hlo, DHT_DEC_BUSY},
+		{DHT_RESPONSE_LOW_US, hlo - 1, DHT_DEC_ERROR},
+		{DHT_RESPONSE_LOW_US, hhi - 1, DHT_DEC_BUSY},
+		{DHT_RESPONSE_LOW_US, hhi, DHT_DEC_ERROR},
+	};
+	unsigned int i;
+
+	for(i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		dht_decoder_reset(&dec);
+		feed(&dec, 10, 20);
+		CHECK_EQ(feed(&dec, cases[i].low, cases[i].high), cases[i].state);
+	}
+}
+
+static void test_bit_windows() {
+	dht_decoder_t dec;
+	unsigned int high;
+
+	/* high time sweep: 0, overlap resolved to 0, 1, nothing */
+	for(high = 0; high < 2 * WIN_HI(DHT_BIT_1_HIGH_US); high++) {
+		start(&dec);
+		dht_dec_state_t state = feed(&dec, DHT_BIT_LOW_US, high);
+
+		if(high >= WIN_LO(DHT_BIT_0_HIGH_US) && high < WIN_HI(DHT_BIT_0_HIGH_US)) {
+			CHECK_EQ(state, DHT_DEC_BUSY);
+			CHECK_EQ(dec.data[0], 0);
+		} else if(high >= WIN_LO(DHT_BIT_1_HIGH_US) && high < WIN_HI(DHT_BIT_1_HIGH_US)) {
+			CHECK_EQ(state, DHT_DEC_BUSY);
+			CHECK_EQ(dec.data[0], 0x80);
+		} else {
+			CHECK_EQ(state, DHT_DEC_ERROR);
+		}
+	}
+
+	/* low time limits are shared by both bit values */
+	start(&dec);
+	CHECK_EQ(feed(&dec, WIN_LO(DHT_BIT_LOW_US) - 1, DHT_BIT_1_HIGH_US), DHT_DEC_ERROR);
+	start(&dec);
+	CHECK_EQ(feed(&dec, WIN_HI(DHT_BIT_LOW_US) - 1, DHT_BIT_1_HIGH_US), DHT_DEC_BUSY);
+	start(&dec);
+	CHECK_EQ(feed(&dec, WIN_HI(DHT_BIT_LOW_US), DHT_BIT_0_HIGH_US), DHT_DEC_ERROR);
+
+	/* low longer than the period is a capture glitch */
+	start(&dec);
+	CHECK_EQ(dht_decoder_feed(&dec, 40, 50), DHT_DEC_ERROR);
+}
+
+/* terminal states are kept, extra edges don't touch the data */
+static void test_terminal() {
+	dht_decoder_t dec;
+	unsigned int bit;
+
+	start(&dec);
+	for(bit = 0; bit < DHT_PKT_SIZE * 8; bit++) feed_bit(&dec, 0);
+	CHECK_EQ(dec.state, DHT_DEC_DONE);
+	CHECK_EQ(feed_bit(&dec, 1), DHT_DEC_DONE);
+	CHECK_EQ(dec.data[0], 0);
+	CHECK_EQ(dec.edge, DHT_EDGES);
+
+	start(&dec);
+	feed_bit(&dec, 1);
+	CHECK_EQ(feed(&dec, DHT_BIT_LOW_US, 200), DHT_DEC_ERROR);
+	CHECK_EQ(feed_bit(&dec, 1), DHT_DEC_ERROR);
+	CHECK_EQ(dec.data[0], 0x80);
+
+	dht_decoder_reset(&dec);
+	CHECK_EQ(dec.state, DHT_DEC_BUSY);
+}
+
+int main() {
+	test_reset();
+	test_bytes();
+	test_response_window();
+	test_bit_windows();
+	test_terminal();
+
+	return test_report("dht_decode");
+}
@@ -0,0 +1,360 @@
+/*
+Dimmer against the modelled zero-cross capture: the test task is interrupted
+by TIM1 captures as the mains input would do it, and looks at the TIM2 and TIM4
+registers the driver leaves behind. Built twice, with the timers updated in the
+capture interrupt and by the dimmer task, to compare what a crossing costs.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "mock.h"
+#include "test.h"
+#include "filter.h"
+#include "dimmer.h"
+
+#ifndef DIMMER_ISR_ONLY
+#define DIMMER_ISR_ONLY 1
+#endif
+
+#define MAINS_PERIOD_US 20000
+#define MAINS_HIGH_US 10400 /* zero-cross input pulse */
+#define SYNC_PERIODS 10 /* AC_SYNC_PERIODS in dimmer.c */
+#define ZC_FILTER_LEN 5
+#define LATENCY_CROSSINGS 100000
+#define GUARD_US 200 /* DIMMER_GUARD_US in dimmer.c */
+#define PWM_OFF 0xffff
+#define RMS_TOLERANCE 0.005 /* of full power */
+#define MISSED_MAX 3 /* AC_MISSED_MAX in dimmer.c */
+
+void TIM1_CC_IRQHandler(void);
+void TIM1_UP_IRQHandler(void);
+
+/*-----------------------------------------------------------------------------*/
+/* one zero-cross capture */
+static void crossing(unsigned int period, unsigned int high) {
+	TIM1->CCR1 = period;
+	TIM1->CCR2 = high;
+	TIM1->SR |= TIM_FLAG_CC1;
+	mock_irq(TIM1_CC_IRQHandler);
+}
+
+/* zero-cross input lost, capture timer overflows */
+static void overflow() {
+	TIM1->SR |= TIM_FLAG_Update;
+	mock_irq(TIM1_UP_IRQHandler);
+}
+
+/* from a gap to released outputs, the first capture after it is discarded */
+static void sync() {
+	unsigned int i;
+	for(i = 0; i < SYNC_PERIODS + 1; i++) crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+
+	mains_stat_t stat;
+	dimmer_get_mains(&stat);
+	CHECK(!stat.fault);
+}
+
+/*-----------------------------------------------------------------------------*/
+/*
+Time from the capture interrupt entry to the timers corrected: with the dimmer
+task the interrupt only wakes it, the test task gets back control after the task
+has written the registers. Periods are jittered so every crossing moves ARR.
+*/
+static void test_latency() {
+	median_t ref;
+	unsigned int i;
+	double t = 0;
+
+	median_init(&ref, ZC_FILTER_LEN);
+	for(i = 0; i < ZC_FILTER_LEN; i++) median_update(&ref, MAINS_PERIOD_US);
+
+	unsigned long switches = mock_switches;
+	for(i = 0; i < LATENCY_CROSSINGS; i++) {
+		unsigned int period = MAINS_PERIOD_US + rand() % 61 - 30;
+		unsigned int half = median_update(&ref, period) >> 1;
+
+		double start = test_time();
+		crossing(period, MAINS_HIGH_US);
+		t += test_time() - start;
+
+		if(TIM2->ARR != half - 1) {
+			CHECK_EQ(TIM2->ARR, half - 1);
+			break;
+		}
+	}
+	switches = mock_switches - switches;
+
+	printf("%s: capture to ARR update %.1f ns, %.2f context switches per crossing\n",
+		DIMMER_ISR_ONLY ? "interrupt" : "task", t * 1e9 / LATENCY_CROSSINGS, (double)switches / LATENCY_CROSSINGS);
+#if DIMMER_ISR_ONLY
+	CHECK_EQ(switches, 0);
+#else
+	/* to the dimmer task and back */
+	CHECK_EQ(switches, 2 * LATENCY_CROSSINGS);
+#endif
+}
+
+/*-----------------------------------------------------------------------------*/
+/*
+Resistive load power share for the compare value of a half-period: the triac
+fires CCR - guard time after the zero crossing and conducts until the next one.
+*/
+static double ccr_power(unsigned int ccr, unsigned int half) {
+	if(ccr == PWM_OFF) return 0;
+	if(ccr <= GUARD_US) return 1;
+
+	double a = M_PI * (ccr - GUARD_US) / half;
+	return 1 - a / M_PI + sin(2 * a) / (2 * M_PI);
+}
+
+static void test_rms() {
+	const unsigned int half = MAINS_PERIOD_US / 2;
+	double prev = 0, max_err = 0;
+	unsigned int steps;
+
+	dimmer_set_ramp(0);
+	dimmer_set_mode(0, DIMMER_PHASE);
+	for(steps = 0; steps < ZC_FILTER_LEN; steps++) crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+
+	for(steps = 0; steps <= DIMMER_STEPS; steps++) {
+		dimmer_set(0, steps * (DIMMER_MAX - DIMMER_MIN) * FP_ONE / DIMMER_STEPS);
+		crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+
+		double p = ccr_power(TIM2->CCR1, half);
+		double err = fabs(p - (double)steps / DIMMER_STEPS);
+		if(err > max_err) max_err = err;
+
+		/* compare values are whole microseconds, equal ones are allowed */
+		if(p < prev) {
+			CHECK(p >= prev);
+			break;
+		}
+		prev = p;
+	}
+
+	CHECK_EQ(ccr_power(TIM2->CCR1, half), 1);
+	printf("rms power over %u steps: max deviation from linear %.2f%% of full power\n", DIMMER_STEPS, max_err * 100);
+	CHECK(max_err <= RMS_TOLERANCE);
+
+	dimmer_set(0, 0);
+	CHECK_EQ(TIM2->CCR1, PWM_OFF);
+}
+
+/*-----------------------------------------------------------------------------*/
+/*
+Burst channel over two DIMMER_STEPS period cycles for every duty: each cycle
+has exactly duty on-periods, spaced evenly so that gaps differ by one period
+at most. A phase channel next to it keeps its compare value.
+*/
+static void test_burst() {
+	unsigned int steps, k;
+	unsigned int bad_count = 0, bad_gaps = 0;
+
+	dimmer_set_ramp(0);
+	dimmer_set_mode(0, DIMMER_PHASE);
+	dimmer_set(0, 50 * FP_ONE);
+	crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+	uint16_t phase_ccr = TIM2->CCR1;
+
+	for(steps = 1; steps < DIMMER_STEPS; steps++) {
+		unsigned int on[2] = {0, 0};
+		unsigned int last = 0, min_gap = UINT32_MAX, max_gap = 0;
+
+		dimmer_set_mode(1, DIMMER_BURST);
+		dimmer_set(1, steps * (DIMMER_MAX - DIMMER_MIN) * FP_ONE / DIMMER_STEPS);
+
+		for(k = 1; k <= 2 * DIMMER_STEPS; k++) {
+			crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+			if(TIM2->CCR2 == PWM_OFF) continue;
+
+			CHECK_EQ(TIM2->CCR2, 0);
+			on[k > DIMMER_STEPS]++;
+			if(last) {
+				unsigned int gap = k - last;
+				if(gap < min_gap) min_gap = gap;
+				if(gap > max_gap) max_gap = gap;
+			}
+			last = k;
+		}
+
+		if(on[0] != steps || on[1] != steps) bad_count++;
+		if(max_gap - min_gap > 1) bad_gaps++;
+		CHECK_EQ(TIM2->CCR1, phase_ccr);
+	}
+
+	printf("burst: %u duties, %u with wrong on-period count, %u unevenly spread\n", DIMMER_STEPS - 1, bad_count, bad_gaps);
+	CHECK_EQ(bad_count, 0);
+	CHECK_EQ(bad_gaps, 0);
+
+	dimmer_set(1, 0);
+	dimmer_set_mode(1, DIMMER_PHASE);
+	CHECK_EQ(TIM2->CCR2, PWM_OFF);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* ramp timing, in zero crossings */
+static fixed_t steps_to_power(unsigned int steps) {
+	return steps * (DIMMER_MAX - DIMMER_MIN) * FP_ONE / DIMMER_STEPS;
+}
+
+/* power dimmer_get reports for steps */
+static fixed_t reported(unsigned int steps) {
+	return DIMMER_MIN * FP_ONE + ((steps * (DIMMER_MAX - DIMMER_MIN)) << FP_FRACT_BITS) / DIMMER_STEPS;
+}
+
+/* crossings until channel 0 reaches target, every one moves it by step */
+static unsigned int ramp(unsigned int from, unsigned int to, unsigned int step) {
+	unsigned int value = from, n = 0;
+	uint16_t ccr = TIM2->CCR1;
+
+	dimmer_set(0, steps_to_power(to));
+	while(dimmer_get(0) != reported(to) && n < 2 * DIMMER_STEPS) {
+		crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+		n++;
+
+		value = to > value ? (to - value > step ? value + step : to) : (value - to > step ? value - step : to);
+		CHECK_EQ(dimmer_get(0), reported(value));
+
+		/* firing moves monotonically */
+		if(to > from) CHECK(TIM2->CCR1 <= ccr);
+		else CHECK(TIM2->CCR1 >= ccr);
+		ccr = TIM2->CCR1;
+	}
+	return n;
+}
+
+static void test_ramp() {
+	static const unsigned int steps[] = {1, 5, 10, 0};
+	unsigned int i;
+
+	dimmer_set_ramp(0);
+	dimmer_set_mode(0, DIMMER_PHASE);
+	dimmer_set(0, 0);
+
+	for(i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		unsigned int step = steps[i];
+		unsigned int periods = step ? DIMMER_STEPS / step : 0;
+
+		dimmer_set_ramp(steps_to_power(step));
+		CHECK_EQ(dimmer_get_ramp(), reported(step));
+
+		unsigned int up = ramp(0, DIMMER_STEPS, step);
+		unsigned int down = ramp(DIMMER_STEPS, 0, step);
+		printf("ramp %u steps per period (0 - none): full range up in %u, down in %u periods\n", step, up, down);
+		CHECK_EQ(up, periods);
+		CHECK_EQ(down, periods);
+		CHECK_EQ(TIM2->CCR1, PWM_OFF);
+	}
+
+	/* partial moves and reversal */
+	dimmer_set_ramp(steps_to_power(10));
+	CHECK_EQ(ramp(0, 255, 10), 26);
+	CHECK_EQ(ramp(255, 100, 10), 16);
+
+	/* mains fault drops the output, it restarts from zero once mains is back */
+	CHECK_EQ(ramp(100, DIMMER_STEPS, 10), 90);
+	overflow();
+	CHECK_EQ(dimmer_get(0), 0);
+	CHECK_EQ(TIM2->CCR1, PWM_OFF);
+
+	unsigned int n;
+	for(n = 0; n < SYNC_PERIODS; n++) {
+		crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+		CHECK_EQ(dimmer_get(0), 0);
+		CHECK_EQ(TIM2->CCR1, PWM_OFF);
+	}
+	/* released with the first step on the same crossing */
+	n = 0;
+	do {
+		crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+		n++;
+	} while(dimmer_get(0) != reported(DIMMER_STEPS) && n < 2 * DIMMER_STEPS);
+	CHECK_EQ(n, DIMMER_STEPS / 10);
+
+	dimmer_set_ramp(0);
+	dimmer_set(0, 0);
+}
+
+/*-----------------------------------------------------------------------------*/
+/*
+Long periods are kept out of the filter as lost crossings: a single one leaves
+the output on, sustained ones, every other crossing lost or mains under the
+frequency limit, must trip the failsafe.
+*/
+static void long_periods(unsigned int period) {
+	mains_stat_t stat;
+	unsigned int i;
+
+	dimmer_set(0, 50 * FP_ONE);
+	crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+	uint16_t ccr = TIM2->CCR1;
+	CHECK(ccr != PWM_OFF);
+
+	for(i = 0; i < 2 * SYNC_PERIODS; i++) {
+		crossing(period, MAINS_HIGH_US);
+		dimmer_get_mains(&stat);
+		if(i + 1 < MISSED_MAX) {
+			CHECK(!stat.fault);
+			CHECK_EQ(TIM2->CCR1, ccr);
+		} else if(!stat.fault || TIM2->CCR1 != PWM_OFF) {
+			printf("%u us periods: output on after %u\n", period, i + 1);
+			CHECK(stat.fault);
+			CHECK_EQ(TIM2->CCR1, PWM_OFF);
+			break;
+		}
+	}
+	CHECK_EQ(dimmer_get(0), 0);
+
+	/* back once the long ones are out of the median window */
+	for(i = 0; i < ZC_FILTER_LEN / 2 + 1; i++) crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+	sync();
+}
+
+static void test_long_periods() {
+	mains_stat_t stat;
+
+	dimmer_set_ramp(0);
+	dimmer_set_mode(0, DIMMER_PHASE);
+
+	/* one lost crossing */
+	sync();
+	dimmer_set(0, 50 * FP_ONE);
+	crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+	dimmer_get_mains(&stat);
+	unsigned long missed = stat.missed, faults = stat.faults;
+
+	crossing(2 * MAINS_PERIOD_US, MAINS_HIGH_US);
+	crossing(MAINS_PERIOD_US, MAINS_HIGH_US);
+	dimmer_get_mains(&stat);
+	CHECK(!stat.fault);
+	CHECK_EQ(stat.missed - missed, 1);
+	CHECK(TIM2->CCR1 != PWM_OFF);
+
+	long_periods(2 * MAINS_PERIOD_US);
+	long_periods(1000000 / 30);
+
+	dimmer_get_mains(&stat);
+	CHECK_EQ(stat.faults - faults, 2);
+	dimmer_set(0, 0);
+}
+
+static void test_thread(void *arg) {
+	dimmer_init();
+
+	overflow();
+	sync();
+	test_latency();
+	test_rms();
+	test_burst();
+	test_ramp();
+	test_long_periods();
+
+	mock_stop();
+}
+
+int main() {
+	mock_run(test_thread, NULL, tskIDLE_PRIORITY + 1);
+	return test_report(DIMMER_ISR_ONLY ? "dimmer" : "dimmer_task");
+}
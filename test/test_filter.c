@@ -0,0 +1,192 @@
+/*
+PID input filter: outlier rejection by the median stage, smoothing against a
+double precision exponential average, parameter limits, and cost per sample.
+The running median is compared against sorting the window on every sample of
+synthetic zero-cross period traces.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "test.h"
+#include "filter.h"
+
+#define BENCH_SAMPLES 1000000
+#define TRACE_LEN 20000
+#define EMA_TOLERANCE 0.02 /* deg C, truncation bias is up to 1 LSB / alpha, well under sensor resolution */
+
+/* DHT22 temperature in tenths as the poll thread feeds it */
+static fixed_t temp_fp(int tenths) {
+	return (tenths * FP_ONE) / 10;
+}
+
+static void test_passthrough() {
+	filter_t f;
+	int i;
+
+	filter_reset(&f);
+	for(i = -400; i < 800; i += 7) CHECK_EQ(filter_update(&f, temp_fp(i), 1, FP_ONE), temp_fp(i));
+
+	/* out of range parameters fall back to no filtering */
+	filter_reset(&f);
+	filter_update(&f, temp_fp(200), 0, 0);
+	CHECK_EQ(filter_update(&f, temp_fp(250), 0, 0), temp_fp(250));
+	CHECK_EQ(f.median.len, 1);
+	CHECK_EQ(filter_update(&f, temp_fp(250), 100, FP_ONE), temp_fp(250));
+	CHECK_EQ(f.median.len, FILTER_MEDIAN_MAX);
+}
+
+static void test_outliers() {
+	filter_t f;
+	unsigned int len, i;
+
+	/* a burst of len / 2 spikes never reaches the output */
+	for(len = 3; len <= FILTER_MEDIAN_MAX; len += 2) {
+		filter_reset(&f);
+		for(i = 0; i < 20; i++) {
+			fixed_t x = (i % len) < len / 2 && i >= len ? temp_fp(850) : temp_fp(231);
+			CHECK_EQ(filter_update(&f, x, len, FP_ONE), temp_fp(231));
+		}
+	}
+
+	/* median window change restarts it */
+	filter_reset(&f);
+	for(i = 0; i < 5; i++) filter_update(&f, temp_fp(100), 5, FP_ONE);
+	CHECK_EQ(filter_update(&f, temp_fp(300), 3, FP_ONE), temp_fp(300));
+	CHECK_EQ(f.median.count, 1);
+}
+
+/* step and noisy input against the same smoother in double */
+static void test_smoothing() {
+	static const double alphas[] = {0.05, 0.1, 0.25, 0.5, 0.9};
+	filter_t f;
+	unsigned int k, i;
+	double max_err = 0;
+
+	srand(1);
+	for(k = 0; k < sizeof(alphas) / sizeof(alphas[0]); k++) {
+		fixed_t alpha = alphas[k] * FP_ONE + 0.5;
+		double a = (double)alpha / FP_ONE;
+		double ema = 0;
+
+		filter_reset(&f);
+		for(i = 0; i < 2000; i++) {
+			int tenths = (i < 1000 ? 200 : 260) + rand() % 11 - 5;
+			fixed_t y = filter_update(&f, temp_fp(tenths), 1, alpha);
+			double x = (double)temp_fp(tenths) / FP_ONE;
+
+			ema = i ? ema + a * (x - ema) : x;
+			double err = fabs((double)y / FP_ONE - ema);
+			if(err > max_err) max_err = err;
+		}
+		CHECK(fabs((double)f.ema / FP_ONE - 26.0) < 0.5);
+	}
+
+	printf("smoothing: max deviation from double %.4f deg C\n", max_err);
+	CHECK(max_err < EMA_TOLERANCE);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* zero-cross periods in microseconds */
+typedef enum {
+	TRACE_50HZ, /* jitter of a few us */
+	TRACE_60HZ_SPIKES, /* noise crossings split periods, lost ones double them */
+	TRACE_DRIFT, /* generator frequency sweeping 47..53 Hz */
+	TRACE_QUANTIZED, /* coarse capture, mostly equal values */
+	TRACE_NUM,
+} trace_t;
+
+static const char *const trace_names[TRACE_NUM] = {"50 Hz", "60 Hz with spikes", "drift", "quantized"};
+
+static int32_t trace_period(trace_t trace, unsigned int i) {
+	int32_t jitter = rand() % 41 - 20;
+
+	switch(trace) {
+	case TRACE_50HZ:
+		return 20000 + jitter;
+	case TRACE_60HZ_SPIKES:
+		if(rand() % 20 == 0) return 1000 + rand() % 15000;
+		if(rand() % 50 == 0) return 33333 + jitter;
+		return 16667 + jitter;
+	case TRACE_DRIFT:
+		return 1000000 / (50 + 3 * sin(i * 0.001)) + jitter;
+	case TRACE_QUANTIZED:
+	default:
+		return 20000 + (rand() % 3 - 1) * 64;
+	}
+}
+
+static int cmp_int32(const void *a, const void *b) {
+	int32_t x = *(const int32_t*)a, y = *(const int32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/* median of the samples in the window, upper one for even counts */
+static int32_t median_ref(const int32_t *hist, unsigned int n, unsigned int len) {
+	int32_t win[MEDIAN_WINDOW_MAX];
+	unsigned int count = n < len ? n : len;
+
+	memcpy(win, hist + n - count, count * sizeof(int32_t));
+	qsort(win, count, sizeof(int32_t), cmp_int32);
+	return win[count / 2];
+}
+
+static void test_median() {
+	static int32_t hist[TRACE_LEN];
+	median_t m;
+	unsigned int len, i;
+	trace_t trace;
+
+	srand(1);
+	for(trace = 0; trace < TRACE_NUM; trace++) {
+		unsigned int mismatches = 0;
+
+		for(i = 0; i < TRACE_LEN; i++) hist[i] = trace_period(trace, i);
+
+		for(len = 1; len <= MEDIAN_WINDOW_MAX; len++) {
+			median_init(&m, len);
+			for(i = 0; i < TRACE_LEN; i++)
+				if(median_update(&m, hist[i]) != median_ref(hist, i + 1, len)) mismatches++;
+			CHECK_EQ(m.count, len);
+		}
+
+		if(mismatches) printf("median, %s trace: %u mismatches\n", trace_names[trace], mismatches);
+		CHECK_EQ(mismatches, 0);
+	}
+
+	/* window length is limited */
+	median_init(&m, 0);
+	CHECK_EQ(m.len, 1);
+	median_init(&m, MEDIAN_WINDOW_MAX + 1);
+	CHECK_EQ(m.len, MEDIAN_WINDOW_MAX);
+}
+
+static void bench() {
+	static fixed_t input[1024];
+	filter_t f;
+	unsigned int i;
+	fixed_t sum = 0;
+
+	for(i = 0; i < 1024; i++) input[i] = temp_fp(230 + rand() % 21 - 10 + (rand() % 50 ? 0 : 400));
+
+	filter_reset(&f);
+	double t = test_time();
+	for(i = 0; i < BENCH_SAMPLES; i++) sum += filter_update(&f, input[i % 1024], FILTER_MEDIAN_MAX, FP_ONE / 8);
+	t = (test_time() - t) / BENCH_SAMPLES;
+
+	/* keeps the loop */
+	CHECK(sum != 0);
+	printf("per sample: median of %u and smoothing %.1f ns\n", FILTER_MEDIAN_MAX, t * 1e9);
+	CHECK(t < 1e-6);
+}
+
+int main() {
+	test_passthrough();
+	test_outliers();
+	test_smoothing();
+	test_median();
+	bench();
+
+	return test_report("filter");
+}
@@ -0,0 +1,204 @@
+/*
+Record log on simulated flash. Every boot is a separate process sharing the
+flash array: the log wraps around all its pages across reboots, and power is
+cut at each program and erase operation in turn, after which the next boot
+must still read every record that was completely written, in order.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "mock.h"
+#include "test.h"
+#include "flash.h"
+#include "flashlog.h"
+
+#define RECS_PER_PAGE (FLASH_PAGE_SIZE / sizeof(flog_rec_t) - 1)
+#define LOG_RECS (FLOG_AREA_PAGES * RECS_PER_PAGE)
+#define TIME0 1000
+#define TIME_STEP 10
+#define CUT_RECS (RECS_PER_PAGE + 10) /* crosses a page boundary */
+#define OPS_PER_REC (sizeof(flog_rec_t) / 4)
+#define OPS_PER_PAGE (1 + OPS_PER_REC) /* erase and header */
+#define FLUSH_TIMEOUT_MS 1000
+
+/* what a boot does */
+typedef struct _boot_t {
+	unsigned int first; /* index of the first record to append */
+	unsigned int count; /* records to append */
+	unsigned int expect_first; /* oldest record index expected in the log */
+	unsigned int expect_count; /* records expected before appending */
+} boot_t;
+
+/*-----------------------------------------------------------------------------*/
+static uint32_t rec_time(unsigned int i) {
+	return TIME0 + i * TIME_STEP;
+}
+
+static void make_rec(unsigned int i, flog_rec_t *rec) {
+	memset(rec, 0, sizeof(*rec));
+	rec->time = rec_time(i);
+	rec->temperature = (int)(i % 700) - 200;
+	rec->humidity = i % 1000;
+	rec->dimmer = i;
+	rec->light = ~i;
+}
+
+static bool rec_ok(unsigned int i, const flog_rec_t *rec) {
+	flog_rec_t exp;
+	make_rec(i, &exp);
+	return rec->time == exp.time && rec->temperature == exp.temperature &&
+		rec->humidity == exp.humidity && rec->dimmer == exp.dimmer && rec->light == exp.light;
+}
+
+/* records expected in the log after n appends to an empty one */
+static unsigned int oldest(unsigned int n) {
+	unsigned int pages = (n + RECS_PER_PAGE - 1) / RECS_PER_PAGE;
+	return pages > FLOG_AREA_PAGES ? (pages - FLOG_AREA_PAGES) * RECS_PER_PAGE : 0;
+}
+
+/* reads the whole log, checks order and contents, returns the record count */
+static unsigned int check_log(unsigned int first) {
+	flog_iter_t it;
+	flog_rec_t rec;
+	unsigned int n = 0;
+
+	flog_seek(0, &it);
+	while(!flog_next(&it, &rec)) {
+		if(!rec_ok(first + n, &rec)) {
+			CHECK(rec_ok(first + n, &rec));
+			break;
+		}
+		n++;
+	}
+	return n;
+}
+
+static void append(unsigned int i) {
+	flog_rec_t rec;
+	make_rec(i, &rec);
+	while(flog_append(&rec)) vTaskDelay(1);
+}
+
+/* waits until record i can be read back */
+static bool flushed(unsigned int i) {
+	portTickType start = xTaskGetTickCount();
+	flog_iter_t it;
+	flog_rec_t rec;
+
+	while(xTaskGetTickCount() - start < FLUSH_TIMEOUT_MS / portTICK_RATE_MS) {
+		flog_seek(rec_time(i), &it);
+		if(!flog_next(&it, &rec) && rec.time == rec_time(i)) return true;
+		vTaskDelay(1);
+	}
+	return false;
+}
+
+static void boot_thread(void *arg) {
+	const boot_t *boot = arg;
+	unsigned int i;
+
+	flash_init();
+	CHECK_EQ(flog_init(), 0);
+	CHECK_EQ(check_log(boot->expect_first), boot->expect_count);
+
+	for(i = 0; i < boot->count; i++) append(boot->first + i);
+	if(boot->count) CHECK(flushed(boot->first + boot->count - 1));
+	CHECK_EQ(flog_errors(), 0);
+
+	mock_stop();
+}
+
+/* seek lands on the first record not older than the requested time */
+static void seek_thread(void *arg) {
+	const boot_t *boot = arg;
+	unsigned int last = boot->expect_first + boot->expect_count - 1;
+	flog_iter_t it;
+	flog_rec_t rec;
+	uint32_t t;
+
+	flash_init();
+	flog_init();
+
+	for(t = 0; t < rec_time(last) + 2 * TIME_STEP; t += 3) {
+		flog_seek(t, &it);
+		if(t > rec_time(last)) {
+			CHECK(flog_next(&it, &rec));
+			continue;
+		}
+
+		unsigned int i = t < rec_time(boot->expect_first) ? boot->expect_first : (t - TIME0 + TIME_STEP - 1) / TIME_STEP;
+		CHECK_EQ(flog_next(&it, &rec), 0);
+		CHECK_EQ(rec.time, rec_time(i));
+	}
+
+	mock_stop();
+}
+
+static int run_boot(unsigned int first, unsigned int count, unsigned int expect_first) {
+	boot_t boot = {
+		.first = first,
+		.count = count,
+		.expect_first = expect_first,
+		.expect_count = first - expect_first,
+	};
+	return mock_boot(boot_thread, &boot, tskIDLE_PRIORITY + 1);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* fill the log several times over across reboots */
+static void test_wrap() {
+	const unsigned int chunk = LOG_RECS / 3 + 7;
+	unsigned int n = 0;
+
+	mock_flash_erase_all();
+	while(n < 3 * LOG_RECS) {
+		CHECK_EQ(run_boot(n, chunk, oldest(n)), 0);
+		n += chunk;
+	}
+	CHECK_EQ(run_boot(n, 0, oldest(n)), 0);
+
+	boot_t boot = {.expect_first = oldest(n), .expect_count = n - oldest(n)};
+	CHECK_EQ(mock_boot(seek_thread, &boot, tskIDLE_PRIORITY + 1), 0);
+}
+
+/* operations that complete record i on an empty log */
+static unsigned long rec_done_ops(unsigned int i) {
+	return (i / RECS_PER_PAGE + 1) * OPS_PER_PAGE + (i + 1) * OPS_PER_REC;
+}
+
+static void test_power_loss() {
+	const unsigned long total = rec_done_ops(CUT_RECS - 1);
+	unsigned long cut;
+
+	for(cut = 1; cut <= total; cut++) {
+		mock_flash_erase_all();
+		mock_flash->ops = 0;
+		mock_flash->cut = cut;
+		CHECK_EQ(run_boot(0, CUT_RECS, 0), MOCK_POWER_LOSS);
+		mock_flash->cut = 0;
+
+		/* all records finished before the cut are there, the torn one is not */
+		unsigned int done = 0;
+		while(done < CUT_RECS && rec_done_ops(done) < cut) done++;
+
+		/* recover, continue appending and read everything back */
+		int failures = run_boot(done, CUT_RECS, 0);
+		failures += run_boot(done + CUT_RECS, 0, 0);
+		if(failures) {
+			printf("power cut at operation %lu of %lu\n", cut, total);
+			CHECK_EQ(failures, 0);
+			break;
+		}
+	}
+}
+
+int main() {
+	test_wrap();
+	test_power_loss();
+
+	printf("%u records per page, %u pages, power cut at each of %lu operations\n",
+		(unsigned int)RECS_PER_PAGE, FLOG_AREA_PAGES, rec_done_ops(CUT_RECS - 1));
+	CHECK_EQ(mock_flash->locked_writes, 0);
+	return test_report("flashlog");
+}
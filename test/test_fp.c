@@ -0,0 +1,161 @@
+/*
+Fixed point ln and exp, dew point and VPD against double precision over the
+sensor range: worst error is checked against bounds and printed with the time
+per call, compared with the same formulas evaluated in double.
+*/
+#include <stdint.h>
+#include <math.h>
+
+#include "test.h"
+#include "fp.h"
+#include "psychro.h"
+
+#define BENCH_CALLS 1000000
+#define LN_MAX_LSB 1.0
+#define EXP_MAX_REL 1e-5 /* beyond output rounding */
+#define DEW_MAX_ERR 0.05 /* deg C, half of sensor resolution */
+/* vpd: truncations cost a few LSB, exponent argument quantization a fraction of saturation pressure */
+#define VPD_MAX_LSB 4
+#define VPD_MAX_REL 0.001
+
+/* Magnus coefficients as in psychro.c */
+#define MAGNUS_A 17.62
+#define MAGNUS_B 243.12
+#define MAGNUS_ES0 0.6112
+
+static double to_d(fixed_t x) {
+	return (double)x / FP_ONE;
+}
+
+static double dew_point_ref(double t, double rh) {
+	double g = log(rh / 100) + MAGNUS_A * t / (MAGNUS_B + t);
+	return MAGNUS_B * g / (MAGNUS_A - g);
+}
+
+static double es_ref(double t) {
+	return MAGNUS_ES0 * exp(MAGNUS_A * t / (MAGNUS_B + t));
+}
+
+static double vpd_ref(double t, double rh) {
+	return es_ref(t) * (1 - rh / 100);
+}
+
+/*-----------------------------------------------------------------------------*/
+static void test_ln() {
+	double max_err = 0;
+	fixed_t x;
+
+	CHECK_EQ(fp_ln(0), FP_MIN);
+	CHECK_EQ(fp_ln(-FP_ONE), FP_MIN);
+	CHECK_EQ(fp_ln(FP_ONE), 0);
+
+	/* every value up to 64, then geometric steps to the top of the range */
+	for(x = 1; x < FP_MAX - FP_MAX / 1000; x += x < 64 * FP_ONE ? 1 : x / 1000) {
+		double err = fabs(fp_ln(x) - log(to_d(x)) * FP_ONE);
+		if(err > max_err) max_err = err;
+	}
+
+	printf("fp_ln: max error %.2f LSB\n", max_err);
+	CHECK(max_err <= LN_MAX_LSB);
+}
+
+static void test_exp() {
+	double max_rel = 0;
+	fixed_t x;
+
+	CHECK_EQ(fp_exp(0), FP_ONE);
+	CHECK_EQ(fp_exp(15 * FP_ONE), FP_MAX);
+	CHECK_EQ(fp_exp(FP_MAX), FP_MAX);
+	CHECK_EQ(fp_exp(-20 * FP_ONE), 0);
+
+	/* results representable, up to ln(FP_MAX / FP_ONE) */
+	for(x = -8 * FP_ONE; x < 14 * FP_ONE; x++) {
+		double ref = exp(to_d(x)) * FP_ONE;
+		double err = fabs(fp_exp(x) - ref);
+		double rel = (err - 0.5) / ref;
+		if(rel > max_rel) max_rel = rel;
+	}
+
+	printf("fp_exp: max relative error beyond rounding %.2e\n", max_rel);
+	CHECK(max_rel <= EXP_MAX_REL);
+}
+
+/* DHT22 range, in its 1/10 units */
+static void test_psychro() {
+	double max_dew = 0, max_vpd = 0;
+	int t, h;
+
+	for(t = -400; t <= 800; t += 3) {
+		for(h = 1; h <= 1000; h += 3) {
+			double dew = fabs(to_d(psy_dew_point(t, h)) - dew_point_ref(t / 10.0, h / 10.0));
+			double vpd = (fabs(to_d(psy_vpd(t, h)) - vpd_ref(t / 10.0, h / 10.0)) - (double)VPD_MAX_LSB / FP_ONE) / es_ref(t / 10.0);
+			if(dew > max_dew) max_dew = dew;
+			if(vpd > max_vpd) max_vpd = vpd;
+		}
+	}
+
+	/* saturated air, dew point is the temperature and no deficit */
+	CHECK(fabs(to_d(psy_dew_point(253, 1000)) - 25.3) < DEW_MAX_ERR);
+	CHECK_EQ(psy_vpd(253, 1000), 0);
+	/* out of range humidity is clamped */
+	CHECK_EQ(psy_dew_point(253, 1200), psy_dew_point(253, 1000));
+	CHECK_EQ(psy_vpd(253, -5), psy_vpd(253, 1));
+
+	printf("dew point: max error %.4f deg C, vpd: max error %d LSB + %.3f%% of saturation pressure\n", max_dew, VPD_MAX_LSB, max_vpd * 100);
+	CHECK(max_dew <= DEW_MAX_ERR);
+	CHECK(max_vpd <= VPD_MAX_REL);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* inputs are varied so that calls can't be hoisted, results summed to keep them */
+static volatile double sink_d;
+static volatile fixed_t sink;
+
+static void bench() {
+	unsigned int i;
+	fixed_t sum = 0;
+	double sum_d = 0;
+
+	double t = test_time();
+	for(i = 0; i < BENCH_CALLS; i++) sum += fp_ln(FP_ONE + i);
+	double t_ln = test_time() - t;
+
+	t = test_time();
+	for(i = 0; i < BENCH_CALLS; i++) sum_d += log(to_d(FP_ONE + i));
+	double t_ln_d = test_time() - t;
+
+	t = test_time();
+	for(i = 0; i < BENCH_CALLS; i++) sum += fp_exp(i & 0x3fff);
+	double t_exp = test_time() - t;
+
+	t = test_time();
+	for(i = 0; i < BENCH_CALLS; i++) sum_d += exp(to_d(i & 0x3fff));
+	double t_exp_d = test_time() - t;
+
+	t = test_time();
+	for(i = 0; i < BENCH_CALLS; i++) sum += psy_dew_point(i % 500, 1 + i % 1000) + psy_vpd(i % 500, 1 + i % 1000);
+	double t_psy = test_time() - t;
+
+	t = test_time();
+	for(i = 0; i < BENCH_CALLS; i++)
+		sum_d += dew_point_ref((i % 500) / 10.0, (1 + i % 1000) / 10.0) + vpd_ref((i % 500) / 10.0, (1 + i % 1000) / 10.0);
+	double t_psy_d = test_time() - t;
+
+	sink = sum;
+	sink_d = sum_d;
+
+	printf("per call, fixed / double: ln %.1f / %.1f ns, exp %.1f / %.1f ns, dew point and vpd %.1f / %.1f ns\n",
+		t_ln * 1e9 / BENCH_CALLS, t_ln_d * 1e9 / BENCH_CALLS, t_exp * 1e9 / BENCH_CALLS, t_exp_d * 1e9 / BENCH_CALLS,
+		t_psy * 1e9 / BENCH_CALLS, t_psy_d * 1e9 / BENCH_CALLS);
+	/* both run once per sensor read, every 2 s */
+	CHECK(t_psy / BENCH_CALLS < 1e-6);
+}
+
+int main() {
+	test_ln();
+	test_exp();
+	test_psychro();
+	bench();
+
+	return test_report("fp");
+}
@@ -0,0 +1,186 @@
+/*
+SPSC ring: index arithmetic across wrap and counter overflow, transition
+reporting for notifications, interleaved producer and consumer, and
+per-byte throughput against the FreeRTOS queue it replaced.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "mock.h"
+#include "test.h"
+#include "ring.h"
+#include "queue.h"
+
+#define RING_LEN 256
+#define BENCH_BYTES (4 * 1024 * 1024)
+
+static char buf[RING_LEN];
+
+static void test_put_get() {
+	ring_t r;
+	char ch;
+	unsigned int i;
+
+	ring_init(&r, buf, RING_LEN);
+	CHECK_EQ(ring_used(&r), 0);
+	CHECK_EQ(ring_free(&r), RING_LEN);
+
+	/* only the first byte wakes the consumer */
+	CHECK(ring_put(&r, 'a'));
+	CHECK(!ring_put(&r, 'b'));
+	CHECK_EQ(ring_used(&r), 2);
+
+	CHECK(!ring_get(&r, &ch));
+	CHECK_EQ(ch, 'a');
+	CHECK(!ring_get(&r, &ch));
+	CHECK_EQ(ch, 'b');
+	CHECK_EQ(ring_used(&r), 0);
+
+	/* only the first byte out of a full ring wakes the producer */
+	for(i = 0; i < RING_LEN; i++) ring_put(&r, i);
+	CHECK_EQ(ring_free(&r), 0);
+	CHECK(ring_get(&r, &ch));
+	CHECK_EQ((unsigned char)ch, 0);
+	CHECK(!ring_get(&r, &ch));
+	CHECK_EQ((unsigned char)ch, 1);
+}
+
+static void test_overflow() {
+	ring_t r;
+	char ch;
+	unsigned int i;
+
+	/* free running indices about to wrap the counter */
+	ring_init(&r, buf, RING_LEN);
+	r.head = r.tail = UINT_MAX - 10;
+
+	for(i = 0; i < 100; i++) CHECK_EQ(ring_put(&r, i), i == 0);
+	CHECK_EQ(ring_used(&r), 100);
+	CHECK(r.head < r.tail);
+
+	for(i = 0; i < 100; i++) {
+		ring_get(&r, &ch);
+		CHECK_EQ((unsigned char)ch, i);
+	}
+	CHECK_EQ(ring_used(&r), 0);
+}
+
+static void test_spans() {
+	ring_t r;
+	char data[RING_LEN];
+	unsigned int i, len;
+
+	for(i = 0; i < RING_LEN; i++) data[i] = i * 7;
+
+	/* copy in across the end of buffer */
+	ring_init(&r, buf, RING_LEN);
+	r.head = r.tail = RING_LEN - 10;
+	CHECK_EQ(ring_copy_in(&r, data, 30), 30);
+	CHECK(ring_commit(&r, 30));
+	CHECK(!ring_commit(&r, 0));
+
+	const char *span = ring_read_span(&r, &len);
+	CHECK_EQ(len, 10);
+	CHECK(!memcmp(span, data, 10));
+	CHECK(!ring_consume(&r, len));
+
+	span = ring_read_span(&r, &len);
+	CHECK_EQ(len, 20);
+	CHECK(!memcmp(span, data + 10, 20));
+	ring_consume(&r, len);
+
+	/* copy in is limited by free space, nothing is published until commit */
+	CHECK_EQ(ring_copy_in(&r, data, RING_LEN), RING_LEN);
+	CHECK_EQ(ring_used(&r), 0);
+	ring_commit(&r, RING_LEN);
+	CHECK_EQ(ring_copy_in(&r, data, 1), 0);
+
+	char *wspan = ring_write_span(&r, &len);
+	CHECK_EQ(len, 0);
+
+	/* write span stops at the end of buffer */
+	CHECK(ring_consume(&r, RING_LEN));
+	wspan = ring_write_span(&r, &len);
+	CHECK_EQ(len, RING_LEN - 20);
+	CHECK(wspan == buf + 20);
+}
+
+/* consumer runs at random points of the producer stream, as an interrupt would */
+static void test_interleaved() {
+	ring_t r;
+	unsigned char next_in = 0, next_out = 0;
+	unsigned long in = 0, out = 0;
+	char data[64];
+	unsigned int i;
+
+	srand(1);
+	ring_init(&r, buf, RING_LEN);
+
+	while(out < 1000000) {
+		unsigned int n = rand() % 64;
+
+		if(rand() & 1) {
+			for(i = 0; i < n; i++) data[i] = next_in + i;
+			n = ring_copy_in(&r, data, n);
+			ring_commit(&r, n);
+			next_in += n;
+			in += n;
+		} else {
+			unsigned int len;
+			const char *span = ring_read_span(&r, &len);
+			if(len > n) len = n;
+			for(i = 0; i < len; i++) CHECK_EQ((unsigned char)span[i], next_out++);
+			ring_consume(&r, len);
+			out += len;
+		}
+		CHECK(ring_used(&r) <= RING_LEN);
+		CHECK_EQ(ring_used(&r), in - out);
+	}
+}
+
+/*-----------------------------------------------------------------------------*/
+/* one byte at a time through both, as the USART interrupt moves it */
+static void bench(void *arg) {
+	xQueueHandle queue = xQueueCreate(RING_LEN, sizeof(char));
+	ring_t r;
+	unsigned long i, j;
+	char ch = 0;
+	portBASE_TYPE woken;
+
+	CHECK(queue != NULL);
+	ring_init(&r, buf, RING_LEN);
+
+	double t = test_time();
+	for(i = 0; i < BENCH_BYTES; i += RING_LEN) {
+		for(j = 0; j < RING_LEN; j++) xQueueSend(queue, &ch, 0);
+		for(j = 0; j < RING_LEN; j++) xQueueReceiveFromISR(queue, &ch, &woken);
+	}
+	double t_queue = test_time() - t;
+
+	t = test_time();
+	for(i = 0; i < BENCH_BYTES; i += RING_LEN) {
+		for(j = 0; j < RING_LEN; j++) ring_put(&r, j);
+		for(j = 0; j < RING_LEN; j++) ring_get(&r, &ch);
+	}
+	double t_ring = test_time() - t;
+	CHECK_EQ(ring_used(&r), 0);
+
+	printf("per byte: queue %.1f ns, ring %.1f ns (%.1fx)\n",
+		t_queue * 1e9 / BENCH_BYTES, t_ring * 1e9 / BENCH_BYTES, t_queue / t_ring);
+	CHECK(t_ring < t_queue);
+
+	mock_stop();
+}
+
+int main() {
+	test_put_get();
+	test_overflow();
+	test_spans();
+	test_interleaved();
+
+	mock_run(bench, NULL, tskIDLE_PRIORITY + 1);
+	return test_report("ring");
+}
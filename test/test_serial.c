@@ -0,0 +1,266 @@
+/*
+Serial transmit paths against modelled USART and DMA: port 0 drains its ring
+by DMA, port 1 by the TXE interrupt. Both must put out exactly what was written,
+the test counts interrupt entries each path takes for the same output.
+Writer side cost is compared for per-character and bulk writes.
+Port 1 receives by the RXNE interrupt, a span returned by serial_rcv must
+survive reception until the next call.
+*/
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "mock.h"
+#include "test.h"
+#include "serial.h"
+
+#define BAUDRATE 57600
+#define BYTES_PER_TICK (BAUDRATE / 10 / configTICK_RATE_HZ) /* 8N1 */
+#define OUT_LEN 8192
+#define DRAIN_TIMEOUT_MS 2000
+#define DUMP_LINES 60 /* cfgvars dump sized */
+#define BENCH_WRITES 2000
+#define STALL_TIMEOUT_MS 10
+#define RX_LEN 256 /* RX_BUF_LEN in serial.c */
+
+void USART2_IRQHandler(void);
+void DMAChannel4_IRQHandler(void);
+
+typedef struct _port_model_t {
+	char out[OUT_LEN];
+	unsigned int len;
+	unsigned long irqs;
+	/* DMA transfer state */
+	unsigned int pos;
+	unsigned int last_cndtr;
+} port_model_t;
+
+static port_model_t ports[SERIAL_NUM];
+static unsigned int line_rate = BYTES_PER_TICK; /* bytes per tick, 0 stalls the line */
+static char expect[SERIAL_NUM][OUT_LEN];
+static unsigned int expect_len[SERIAL_NUM];
+
+/*-----------------------------------------------------------------------------*/
+/* hardware side */
+static void irq(port_model_t *port, mock_isr_t isr) {
+	port->irqs++;
+	mock_irq(isr);
+}
+
+static void dma_port_tick(port_model_t *port) {
+	DMA_Channel_TypeDef *ch = DMA1_Channel4;
+	unsigned int n = line_rate;
+
+	if(ch->CNDTR != port->last_cndtr) port->pos = 0; /* reloaded by the driver */
+
+	while(n && (ch->CCR & DMA_CCR1_EN) && (USART1->CR3 & USART_DMAReq_Tx) && ch->CNDTR) {
+		port->out[port->len++ % OUT_LEN] = ((const char*)(uintptr_t)ch->CMAR)[port->pos++];
+		port->last_cndtr = --ch->CNDTR;
+		n--;
+
+		if(!ch->CNDTR) {
+			DMA1->ISR |= DMA1_FLAG_TC4 | DMA1_FLAG_GL4;
+			if(ch->CCR & DMA_IT_TC) irq(port, DMAChannel4_IRQHandler);
+			if(ch->CNDTR != port->last_cndtr) port->pos = 0;
+		}
+	}
+
+	if(n) USART1->SR |= USART_FLAG_TC; /* shifter idle */
+}
+
+static void txe_port_tick(port_model_t *port) {
+	unsigned int n;
+
+	for(n = 0; n < line_rate; n++) {
+		if(USART_GetITStatus(USART2, USART_IT_TXE)) irq(port, USART2_IRQHandler);
+		if(USART2->SR & USART_FLAG_TXE) break;
+
+		/* data register moves to the shifter */
+		port->out[port->len++ % OUT_LEN] = USART2->DR;
+		USART2->SR |= USART_FLAG_TXE;
+	}
+
+	if(n < line_rate) USART2->SR |= USART_FLAG_TC;
+}
+
+static void hw_tick(void) {
+	dma_port_tick(&ports[0]);
+	txe_port_tick(&ports[1]);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* writer side, mirrors output to the expected buffer */
+static void put_str(int n, const char *str) {
+	int len = strlen(str);
+	CHECK_EQ(serial_send_str(n, str, len, portMAX_DELAY), len);
+	memcpy(expect[n] + expect_len[n], str, len);
+	expect_len[n] += len;
+}
+
+static void put_char(int n, char ch) {
+	CHECK_EQ(serial_send_char(n, ch, portMAX_DELAY), 0);
+	expect[n][expect_len[n]++] = ch;
+}
+
+static void put_var(int n, int i) {
+	int len = serial_iprintf(n, portMAX_DELAY, "var.%02d = %d.%u %s\r\n", i, i * 37 - 500, i % 10, i & 1 ? "on" : "off");
+	int exp = sprintf(expect[n] + expect_len[n], "var.%02d = %d.%u %s\r\n", i, i * 37 - 500, i % 10, i & 1 ? "on" : "off");
+	CHECK_EQ(len, exp);
+	expect_len[n] += exp;
+}
+
+static void dump(int n) {
+	int i;
+	put_str(n, "\r\n# cfgvars\r\n");
+	for(i = 0; i < DUMP_LINES; i++) put_var(n, i);
+	for(i = 0; i < 32; i++) put_char(n, 'a' + i % 26);
+	put_str(n, "\r\n> ");
+}
+
+static bool wait_sent(int n, unsigned int len) {
+	portTickType start = xTaskGetTickCount();
+	while(ports[n].len < len) {
+		if(xTaskGetTickCount() - start > DRAIN_TIMEOUT_MS / portTICK_RATE_MS) return false;
+		vTaskDelay(1);
+	}
+	return true;
+}
+
+static bool drained(int n) {
+	return wait_sent(n, expect_len[n]);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* writes beyond free space with the line stalled */
+static void test_partial(int n) {
+	char data[SERIAL_TX_BUF_LEN + 100];
+	serial_stats_t before, after;
+
+	memset(data, '-', sizeof(data));
+	line_rate = 0;
+
+	/* blocking write gives up after timeout with the buffer full */
+	serial_get_stats(n, &before);
+	portTickType start = xTaskGetTickCount();
+	CHECK_EQ(serial_send_str(n, data, sizeof(data), STALL_TIMEOUT_MS / portTICK_RATE_MS), SERIAL_TX_BUF_LEN);
+	CHECK(xTaskGetTickCount() - start >= STALL_TIMEOUT_MS / portTICK_RATE_MS);
+	serial_get_stats(n, &after);
+	CHECK_EQ(after.tx_dropped - before.tx_dropped, sizeof(data) - SERIAL_TX_BUF_LEN);
+
+	/* a write that doesn't fit is dropped whole */
+	serial_set_policy(n, SERIAL_DROP_NEWEST);
+	CHECK_EQ(serial_send_str(n, data, 10, 0), 0);
+	serial_get_stats(n, &before);
+	CHECK_EQ(before.tx_dropped - after.tx_dropped, 10);
+	serial_set_policy(n, SERIAL_BLOCK);
+
+	line_rate = BYTES_PER_TICK;
+	CHECK(wait_sent(n, ports[n].len + SERIAL_TX_BUF_LEN));
+}
+
+/* writer side time per byte, line drained between writes */
+static double bench_write(int n, bool bulk) {
+	static const char line[] = "dim.fan.power = 42.50\r\n";
+	unsigned int len = sizeof(line) - 1;
+	unsigned int sent = ports[n].len;
+	double t = 0;
+	int k;
+	unsigned int i;
+
+	line_rate = SERIAL_TX_BUF_LEN;
+	for(k = 0; k < BENCH_WRITES; k++) {
+		double start = test_time();
+		if(bulk) {
+			serial_send_str(n, line, len, portMAX_DELAY);
+		} else {
+			for(i = 0; i < len; i++) serial_send_char(n, line[i], portMAX_DELAY);
+		}
+		t += test_time() - start;
+
+		sent += len;
+		CHECK(wait_sent(n, sent));
+	}
+	line_rate = BYTES_PER_TICK;
+
+	return t / (BENCH_WRITES * len);
+}
+
+/*-----------------------------------------------------------------------------*/
+/* receive side, port 1 */
+static void rx_byte(char ch) {
+	USART2->DR = (uint8_t)ch;
+	USART2->SR |= USART_FLAG_RXNE;
+	mock_irq(USART2_IRQHandler);
+}
+
+static void test_rcv_span() {
+	const char *data;
+	serial_stats_t before, after;
+	unsigned int i;
+
+	for(i = 0; i < 10; i++) rx_byte('a' + i);
+	CHECK_EQ(serial_rcv(1, &data, 0), 10);
+
+	/* the held span is not free space, overflowing reception is dropped instead */
+	serial_get_stats(1, &before);
+	for(i = 0; i < RX_LEN; i++) rx_byte('x');
+	serial_get_stats(1, &after);
+	CHECK(!memcmp(data, "abcdefghij", 10));
+	CHECK_EQ(after.rx_dropped - before.rx_dropped, 10);
+
+	/* released by the next call */
+	CHECK_EQ(serial_rcv(1, &data, 0), RX_LEN - 10);
+	for(i = 0; i < RX_LEN - 10; i++) CHECK_EQ(data[i], 'x');
+	CHECK_EQ(serial_rcv(1, &data, 0), -1);
+
+	char ch;
+	rx_byte('z');
+	CHECK_EQ(serial_rcv_char(1, &ch, 0), 0);
+	CHECK_EQ(ch, 'z');
+}
+
+static void test_thread(void *arg) {
+	int n;
+
+	for(n = 0; n < SERIAL_NUM; n++) {
+		CHECK_EQ(serial_init(n, BAUDRATE), 0);
+		serial_enabled(n, 1);
+	}
+	mock_set_hw(hw_tick);
+
+	for(n = 0; n < SERIAL_NUM; n++) {
+		dump(n);
+		CHECK(drained(n));
+		CHECK_EQ(ports[n].len, expect_len[n]);
+		CHECK(!memcmp(ports[n].out, expect[n], expect_len[n]));
+
+		serial_stats_t stats;
+		serial_get_stats(n, &stats);
+		CHECK_EQ(stats.tx_dropped, 0);
+	}
+
+	/* output is byte-exact, compare interrupt load for the same dump */
+	printf("%u bytes: TXE path %lu interrupts, DMA path %lu interrupts (%lu saved)\n",
+		expect_len[0], ports[1].irqs, ports[0].irqs, ports[1].irqs - ports[0].irqs);
+	CHECK(ports[1].irqs >= expect_len[1]);
+	CHECK(ports[0].irqs * 8 < ports[1].irqs);
+
+	for(n = 0; n < SERIAL_NUM; n++) {
+		test_partial(n);
+
+		double per_char = bench_write(n, false);
+		double bulk = bench_write(n, true);
+		printf("port %d write: per character %.1f ns/byte, bulk %.1f ns/byte\n", n, per_char * 1e9, bulk * 1e9);
+		CHECK(bulk < per_char);
+	}
+
+	test_rcv_span();
+
+	mock_stop();
+}
+
+int main() {
+	mock_run(test_thread, NULL, tskIDLE_PRIORITY + 1);
+	return test_report("serial");
+}
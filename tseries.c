@@ -0,0 +1,83 @@
+/* Sensor time series with fixed resolution */
+#include <string.h>
+#include "tseries.h"
+
+#define TS_TEMPERATURE 0
+#define TS_HUMIDITY 1
+
+static inline uint8_t delta_pack(int d) {
+	return d > TS_DELTA_MAX ? TS_DELTA_MAX : d;
+}
+
+static void pack_value(ts_value_t *v, const ts_acc_t *acc, int n) {
+	if(!acc->count) {
+		v->avg = TS_EMPTY;
+		v->below = v->above = 0;
+		return;
+	}
+
+	/* round to nearest */
+	long sum = acc->sum[n];
+	int avg = sum >= 0 ? (sum + acc->count / 2) / acc->count : -((-sum + acc->count / 2) / acc->count);
+
+	v->avg = avg;
+	v->below = delta_pack(avg - acc->min[n]);
+	v->above = delta_pack(acc->max[n] - avg);
+}
+
+static void acc_reset(ts_acc_t *acc) {
+	memset(acc, 0, sizeof(*acc));
+}
+
+static void close_bucket(ts_ring_t *r) {
+	ts_bucket_t *b = &r->buf[r->head % r->size];
+	pack_value(&b->temperature, &r->acc, TS_TEMPERATURE);
+	pack_value(&b->humidity, &r->acc, TS_HUMIDITY);
+	r->head++;
+
+	acc_reset(&r->acc);
+}
+
+void ts_init(ts_ring_t *r, ts_bucket_t *buf, unsigned int size, unsigned int period) {
+	r->buf = buf;
+	r->size = size;
+	r->period = period;
+	r->slot = 0;
+	r->head = 0;
+	acc_reset(&r->acc);
+}
+
+void ts_add(ts_ring_t *r, unsigned long now, int temperature, int humidity) {
+	unsigned long slot = now / r->period;
+
+	if(!r->head && !r->acc.count) {
+		/* first sample */
+		r->slot = slot;
+	} else if(slot != r->slot) {
+		/* skipped periods, bounded by ring size (time wrap empties the ring) */
+		unsigned long gap = slot - r->slot - 1;
+		if(gap > r->size) gap = r->size;
+
+		close_bucket(r);
+		while(gap--) close_bucket(r);
+
+		r->slot = slot;
+	}
+
+	ts_acc_t *acc = &r->acc;
+	int val[2] = {temperature, humidity};
+	int n;
+	for(n = 0; n < 2; n++) {
+		acc->sum[n] += val[n];
+		if(!acc->count || val[n] < acc->min[n]) acc->min[n] = val[n];
+		if(!acc->count || val[n] > acc->max[n]) acc->max[n] = val[n];
+	}
+	acc->count++;
+}
+
+int ts_get(const ts_ring_t *r, unsigned int age, ts_bucket_t *bucket) {
+	if(age >= r->size || age >= r->head) return -1;
+
+	*bucket = r->buf[(r->head - 1 - age) % r->size];
+	return 0;
+}
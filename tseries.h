@@ -0,0 +1,50 @@
+#ifndef _TSERIES_H_
+#define _TSERIES_H_
+
+#include <stdint.h>
+
+#define TS_EMPTY INT16_MIN /* bucket without samples */
+#define TS_DELTA_MAX 0xff
+
+/* min = avg - below, max = avg + above, deltas saturate at TS_DELTA_MAX */
+typedef struct _ts_value_t {
+	int16_t avg;
+	uint8_t below;
+	uint8_t above;
+} ts_value_t;
+
+typedef struct _ts_bucket_t {
+	ts_value_t temperature; /* 1/10 deg C */
+	ts_value_t humidity; /* 1/10 % */
+} ts_bucket_t;
+
+/* open bucket accumulator */
+typedef struct _ts_acc_t {
+	long sum[2];
+	int min[2];
+	int max[2];
+	unsigned int count;
+} ts_acc_t;
+
+/*
+Fixed size ring of closed buckets, each one covering period seconds.
+Samples are accumulated in O(1), the bucket is closed when a sample for
+a later period arrives. Periods without samples are stored as empty buckets.
+*/
+typedef struct _ts_ring_t {
+	ts_bucket_t *buf;
+	unsigned int size;
+	unsigned int period; /* seconds */
+	unsigned long slot; /* period number of the open bucket */
+	unsigned long head; /* closed buckets count, free running */
+	ts_acc_t acc;
+} ts_ring_t;
+
+/*-----------------------------------------------------------------------------*/
+void ts_init(ts_ring_t *r, ts_bucket_t *buf, unsigned int size, unsigned int period);
+/* now is a monotonic time in seconds */
+void ts_add(ts_ring_t *r, unsigned long now, int temperature, int humidity);
+/* closed bucket, age 0 is the most recent one, returns -1 if not recorded yet */
+int ts_get(const ts_ring_t *r, unsigned int age, ts_bucket_t *bucket);
+
+#endif